@@ -4,22 +4,136 @@
 
 #include "dataStructures.h"
 #include "mykdtree.h"
+#include "voxelHashGrid.h"
+#include <deque>
+#include <limits>
+#include <map>
 #include <opencv2/core.hpp>
 #include <stdio.h>
 #include <vector>
 
+// uniform grid over the image plane which stores, for each cell, the shrunken ROIs overlapping it
+class RoiGridIndex
+{
+public:
+    void build(const std::vector<BoundingBox> &boundingBoxes, float shrinkFactor, int cellSize = 32);
+    // index of the only shrunken ROI which contains pt, -1 if no or several ROIs contain it
+    int findEnclosingBox(const cv::Point &pt) const;
+
+private:
+    std::vector<cv::Rect> smallerBoxes; // shrunken ROIs in the order of the bounding boxes
+    int cellSize;
+    cv::Point origin; // top left corner of the grid
+    int cols, rows;
+    std::vector<int> cellStart; // ROIs of cell c are cellBoxes[cellStart[c]] ... cellBoxes[cellStart[c + 1] - 1]
+    std::vector<int> cellBoxes;
+};
+
 void clusterLidarWithROI(std::vector<BoundingBox> &boundingBoxes, std::vector<LidarPoint> &lidarPoints, float shrinkFactor, cv::Mat &P_rect_xx, cv::Mat &R_rect_xx, cv::Mat &RT);
+void clusterLidarWithROI(std::vector<BoundingBox> &boundingBoxes, std::vector<LidarPoint> &lidarPoints, float shrinkFactor, const cv::Matx34f &lidarToImage);
+void clusterLidarWithROI(DataFrame &frame, float shrinkFactor, const cv::Matx34f &lidarToImage);
 void clusterKptMatchesWithROI(BoundingBox &boundingBox, std::vector<cv::KeyPoint> &kptsPrev, std::vector<cv::KeyPoint> &kptsCurr, std::vector<cv::DMatch> &kptMatches);
 void matchBoundingBoxes(std::vector<cv::DMatch> &matches, std::map<int, int> &bbBestMatches, DataFrame &prevFrame, DataFrame &currFrame);
+int propagateBoundingBoxes(std::vector<cv::DMatch> &matches, DataFrame &prevFrame, DataFrame &currFrame, int minMatches);
 
 void show3DObjects(std::vector<BoundingBox> &boundingBoxes, cv::Size worldSize, cv::Size imageSize, bool bWait=true);
 
-void clusterHelper(int index, std::vector<std::vector<float>>& points, std::vector<int>&  cluster, std::vector<bool>& processed, KdTree* tree, float distanceTol);
-std::vector<std::vector<int>> myEuclideanCluster(std::vector<std::vector<float>>& points, KdTree* tree, float distanceTol);
-std::vector<LidarPoint> removeLidarOutlier(const std::vector<LidarPoint> &lidarPoints, float clusterTolerance);
+// euclidean clustering over Dim dimensional points, the neighbors are found with a KdTree<Dim> or, for a
+// distanceTol up to its cell size, a VoxelHashGrid<Dim>. instantiated for Dim = 2 (bird's eye view) and Dim = 3.
+// only clusters with minSize ... maxSize points are returned
+template <size_t Dim, typename NeighborIndex>
+std::vector<std::vector<int>> myEuclideanCluster(const std::vector<std::array<float, Dim>>& points, const NeighborIndex* tree, float distanceTol,
+                                                 int minSize = 1, int maxSize = std::numeric_limits<int>::max());
+// same clusters as myEuclideanCluster, computed by threads which each link the neighbors of one spatial partition
+// of the cloud into a shared lock-free union-find. clusters are ordered by their smallest point index regardless of
+// the number of threads
+template <size_t Dim>
+std::vector<std::vector<int>> parallelEuclideanCluster(const std::vector<std::array<float, Dim>>& points, const KdTree<Dim>* tree, float distanceTol,
+                                                       int minSize = 1, int maxSize = std::numeric_limits<int>::max());
+const int parallelClusterMinPoints = 4096;  // smaller clouds are clustered sequentially
+const int parallelClusterStripeSize = 1024; // points per partition of the parallel clustering
+
+enum class NeighborSearch { KD_TREE, VOXEL_GRID }; // search structure used by the Lidar outlier filter
+
+// search structures and buffers of the Lidar outlier filters and distance estimators. they keep their storage between
+// calls, so a caller which passes the same workspace every frame does not allocate after the first frame. calls which
+// run concurrently need separate workspaces
+struct LidarTTCWorkspace
+{
+    KdTree3D tree;
+    VoxelHashGrid3D grid;
+    std::vector<std::array<float, 3>> points;
+    std::vector<float> xs;
+};
+
+// statistical outlier removal: drops the points whose mean distance to their numNeighbors nearest neighbors exceeds
+// the mean of that distance over the cloud by more than stddevMult standard deviations. without a workspace, one is
+// created for the call
+std::vector<LidarPoint> removeLidarOutlier(const std::vector<LidarPoint> &lidarPoints, int numNeighbors = 10, float stddevMult = 1.0f,
+                                           LidarTTCWorkspace *workspace = nullptr);
 
 void computeTTCCamera(std::vector<cv::KeyPoint> &kptsPrev, std::vector<cv::KeyPoint> &kptsCurr,
                       std::vector<cv::DMatch> kptMatches, double frameRate, double &TTC, cv::Mat *visImg=nullptr);
+
+// how the distance to the preceding vehicle is estimated from the Lidar points of its bounding box
+enum class LidarDistanceEstimator
+{
+    NEAREST_CLUSTER,    // closest ego-lane point of the nearest cluster with at least minClusterSize points
+    STATISTICAL_FILTER, // closest ego-lane point after statistical outlier removal
+    CLUSTER_FILTER,     // closest ego-lane point after dropping the euclidean clusters of the whole box with less than
+                        // minClusterSize points
+    PERCENTILE          // percentile of the x coordinates of the ego-lane points
+};
+
+struct LidarTTCOptions
+{
+    LidarDistanceEstimator estimator = LidarDistanceEstimator::NEAREST_CLUSTER;
+    double laneWidth = 4.0;        // ego lane of 4 meters is assumed
+    float clusterTolerance = 0.1f; // NEAREST_CLUSTER and CLUSTER_FILTER
+    int minClusterSize = 5;        // NEAREST_CLUSTER and CLUSTER_FILTER
+    NeighborSearch neighborSearch = NeighborSearch::VOXEL_GRID; // CLUSTER_FILTER, NEAREST_CLUSTER always uses the grid
+    int numNeighbors = 10;         // STATISTICAL_FILTER
+    float stddevMult = 1.0f;       // STATISTICAL_FILTER
+    double percentile = 0.1;       // PERCENTILE, 0 is the closest point
+};
+
+// the functions below create a workspace for the call if none is passed
+double closestLidarDistance(const std::vector<LidarPoint> &lidarPoints, const LidarTTCOptions &options,
+                            LidarTTCWorkspace *workspace = nullptr);
 void computeTTCLidar(std::vector<LidarPoint> &lidarPointsPrev,
-                     std::vector<LidarPoint> &lidarPointsCurr, double frameRate, double &TTC);                  
+                     std::vector<LidarPoint> &lidarPointsCurr, double frameRate, double &TTC,
+                     const LidarTTCOptions &options = LidarTTCOptions(), LidarTTCWorkspace *workspace = nullptr);
+// same as above on the Lidar points of two boxes of the same track. the distance of each box is cached on the box
+// together with its estimator, so the previous box of a track reuses the distance computed when it was the current
+// box. a different estimator recomputes the distance, the other options must stay the same between calls on a box
+void computeTTCLidar(BoundingBox &prevBB, BoundingBox &currBB, double frameRate, double &TTC,
+                     const LidarTTCOptions &options = LidarTTCOptions(), LidarTTCWorkspace *workspace = nullptr);
+
+// least-squares fit of the Lidar distance of every track over its last windowSize samples. the sums of the fit are
+// updated in O(1) per sample, the slope of the fit is the relative velocity and TTC = fitted distance / -velocity
+class LidarTTCRegression
+{
+public:
+    explicit LidarTTCRegression(int windowSize = 5) : windowSize(windowSize) {}
+
+    // add the distance of a track at time t in [s], samples which are not newer than the last one are ignored
+    void addSample(int trackID, double t, double distance);
+    // TTC at the time of the last sample of the track, false with less than two samples or without relative motion
+    bool estimateTTC(int trackID, double &TTC) const;
+    int numSamples(int trackID) const;
+    // forget the tracks whose last sample is older than t
+    void removeTracksBefore(double t);
+
+private:
+    struct Track
+    {
+        double t0;                      // time of the first sample, times are stored relative to it
+        std::deque<cv::Point2d> samples; // (t - t0, distance)
+        double sumT = 0, sumD = 0, sumTT = 0, sumTD = 0;
+    };
+
+    int windowSize;
+    std::map<int, Track> tracks;
+};
+
 #endif /* camFusion_hpp */
\ No newline at end of file
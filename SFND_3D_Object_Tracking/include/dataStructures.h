@@ -4,12 +4,52 @@
 
 #include <vector>
 #include <map>
+#include <new>
 #include <opencv2/core.hpp>
 
 struct LidarPoint { // single lidar point in space
     float x,y,z,r; // x,y,z in [m], r is point reflectivity
 };
 
+template <typename T, std::size_t Alignment = 64>
+struct AlignedAllocator { // allocator for SIMD friendly, cache line aligned arrays
+    using value_type = T;
+    template <typename U> struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+    AlignedAllocator() = default;
+    template <typename U> AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+    T *allocate(std::size_t n) { return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(Alignment))); }
+    void deallocate(T *p, std::size_t) { ::operator delete(p, std::align_val_t(Alignment)); }
+
+    template <typename U> bool operator==(const AlignedAllocator<U, Alignment> &) const { return true; }
+    template <typename U> bool operator!=(const AlignedAllocator<U, Alignment> &) const { return false; }
+};
+
+struct LidarCloud { // structure-of-arrays Lidar point cloud, each coordinate is stored in its own aligned array
+    std::vector<float, AlignedAllocator<float>> x, y, z, r;
+
+    std::size_t size() const { return x.size(); }
+    bool empty() const { return x.empty(); }
+    void clear() { x.clear(); y.clear(); z.clear(); r.clear(); }
+    void reserve(std::size_t n) { x.reserve(n); y.reserve(n); z.reserve(n); r.reserve(n); }
+    void push_back(const LidarPoint &pt) { x.push_back(pt.x); y.push_back(pt.y); z.push_back(pt.z); r.push_back(pt.r); }
+    LidarPoint operator[](std::size_t i) const { return {x[i], y[i], z[i], r[i]}; }
+
+    // adapters to and from the array-of-structures layout used by the rest of the pipeline
+    void assign(const LidarPoint *first, const LidarPoint *last) {
+        clear();
+        reserve(last - first);
+        for (const LidarPoint *it = first; it != last; ++it) push_back(*it);
+    }
+    void assign(const std::vector<LidarPoint> &points) { assign(points.data(), points.data() + points.size()); }
+    std::vector<LidarPoint> toPoints() const {
+        std::vector<LidarPoint> points(size());
+        for (std::size_t i = 0; i < size(); ++i) points[i] = (*this)[i];
+        return points;
+    }
+};
+
 struct BoundingBox { // bounding box around a classified object (contains both 2D and 3D data)
     
     int boxID; // unique identifier for this bounding box
@@ -20,10 +60,19 @@ struct BoundingBox { // bounding box around a classified object (contains both 2
     double confidence; // classification trust
 
     std::vector<LidarPoint> lidarPoints; // Lidar 3D points which project into 2D image roi
+    std::vector<int> lidarPointIndices; // position of each of the lidarPoints in the Lidar cloud of its DataFrame
+    double lidarDistance = -1; // robust distance to the closest of the lidarPoints in [m], cached by computeTTCLidar, < 0 until computed
+    int lidarDistanceEstimator = -1; // LidarDistanceEstimator which computed lidarDistance
     std::vector<cv::KeyPoint> keypoints; // keypoints enclosed by 2D roi
     std::vector<cv::DMatch> kptMatches; // keypoint matches enclosed by 2D roi
 };
 
+struct ProjectedLidarPoints { // Lidar points of a frame projected into its camera image
+    std::vector<cv::Point2f> pixels; // pixel coordinates of each point
+    std::vector<float> depths; // depth of each point along the optical axis in [m]
+    bool valid = false; // set once the projection has been computed
+};
+
 struct DataFrame { // represents the available sensor information at the same time instance
     
     cv::Mat cameraImg; // camera image
@@ -32,6 +81,7 @@ struct DataFrame { // represents the available sensor information at the same ti
     cv::Mat descriptors; // keypoint descriptors
     std::vector<cv::DMatch> kptMatches; // keypoint matches between previous and current frame
     std::vector<LidarPoint> lidarPoints;
+    ProjectedLidarPoints lidarProjection; // lazily computed projection of lidarPoints, see getProjectedLidarPoints()
 
     std::vector<BoundingBox> boundingBoxes; // ROI around detected objects in 2D image coordinates
     std::map<int,int> bbMatches; // bounding box matches between previous and current frame
@@ -8,9 +8,85 @@
 
 #include "dataStructures.h"
 
+// read-only view of a memory mapped KITTI Velodyne file, the {x,y,z,r} float records are used in place as LidarPoints
+class LidarFileView
+{
+public:
+    explicit LidarFileView(const std::string &filename);
+    ~LidarFileView();
+    LidarFileView(const LidarFileView &) = delete;
+    LidarFileView &operator=(const LidarFileView &) = delete;
+
+    bool isOpen() const { return mapping != nullptr; }
+    size_t size() const { return numPoints; }
+    const LidarPoint *begin() const { return points; }
+    const LidarPoint *end() const { return points + numPoints; }
+    const LidarPoint &operator[](size_t i) const { return points[i]; }
+
+private:
+    void *mapping;
+    size_t mappedBytes;
+    const LidarPoint *points;
+    size_t numPoints;
+};
+
+// plane a*x + b*y + c*z + d = 0 with unit normal (a, b, c) pointing upwards
+struct Plane
+{
+    float a, b, c, d;
+};
+
+// Fits the road surface with RANSAC and removes it from the cloud. Hypotheses are evaluated in parallel and the
+// plane of the previous frame is used as a warm start, so that only a few new hypotheses are needed per frame.
+class GroundPlaneSegmenter
+{
+public:
+    GroundPlaneSegmenter(float distanceThreshold = 0.15f, int maxIterations = 100, int warmIterations = 10,
+                         float maxTiltDeg = 15.0f);
+
+    // returns false if no plausible road plane was found, the previous plane is kept in that case
+    bool fitPlane(const LidarCloud &cloud);
+    // appends the points whose height above the road plane lies within [minHeight, maxHeight]
+    void removeGround(const LidarCloud &cloud, std::vector<LidarPoint> &lidarPoints, float minHeight, float maxHeight) const;
+
+    bool hasPlane() const { return bHasPlane; }
+    const Plane &getPlane() const { return plane; }
+
+private:
+    int countInliers(const LidarCloud &cloud, const Plane &hypothesis) const;
+
+    Plane plane;
+    bool bHasPlane;
+    float distanceThreshold; // max. point-to-plane distance of an inlier in [m]
+    int maxIterations; // hypotheses without a previous plane
+    int warmIterations; // hypotheses in addition to the previous plane
+    float minNormalZ; // cosine of the max. tilt of the road plane
+    unsigned int frameCount; // seeds the hypothesis sampling, so results do not depend on the thread count
+};
+
 void cropLidarPoints(std::vector<LidarPoint> &lidarPoints, float minX, float maxX, float maxY, float minZ, float maxZ, float minR);
+void cropLidarCloud(const LidarCloud &cloud, LidarCloud &croppedCloud, float minX, float maxX, float maxY, float minZ, float maxZ, float minR);
+void cropLidarPoints(const LidarFileView &lidarFile, std::vector<LidarPoint> &croppedPoints, float minX, float maxX, float maxY, float minZ, float maxZ, float minR);
 void loadLidarFromFile(std::vector<LidarPoint> &lidarPoints, std::string filename);
 
+// point which replaces all Lidar points falling into the same voxel
+enum class VoxelRepresentative
+{
+    CENTROID, // mean y, z and r of the voxel, x is the voxel's minimum so that the closest distance is preserved
+    MIN_X     // the voxel point with the smallest x
+};
+void downsampleLidarPoints(std::vector<LidarPoint> &lidarPoints, float leafSize, VoxelRepresentative representative = VoxelRepresentative::MIN_X);
+bool loadCroppedLidarFromFile(std::vector<LidarPoint> &lidarPoints, std::string filename, float minX, float maxX, float maxY, float minZ, float maxZ, float minR);
+
 void showLidarTopview(std::vector<LidarPoint> &lidarPoints, cv::Size worldSize, cv::Size imageSize, bool bWait=true);
 void showLidarImgOverlay(cv::Mat &img, std::vector<LidarPoint> &lidarPoints, cv::Mat &P_rect_xx, cv::Mat &R_rect_xx, cv::Mat &RT, cv::Mat *extVisImg=nullptr);
+void showLidarImgOverlay(cv::Mat &img, std::vector<LidarPoint> &lidarPoints, const cv::Matx34f &lidarToImage, cv::Mat *extVisImg=nullptr);
+void showLidarImgOverlay(cv::Mat &img, DataFrame &frame, const BoundingBox &boundingBox, const cv::Matx34f &lidarToImage, cv::Mat *extVisImg=nullptr);
+
+// combined 3x4 Lidar-to-image projection P_rect_xx * R_rect_xx * RT, to be computed once per calibration
+cv::Matx34f computeLidarProjection(const cv::Mat &P_rect_xx, const cv::Mat &R_rect_xx, const cv::Mat &RT);
+// projects all points into the image, pixels[i] receives the pixel coordinates and depths[i] the depth of point i
+void projectLidarPoints(const cv::Matx34f &lidarToImage, const LidarPoint *points, size_t numPoints, cv::Point2f *pixels, float *depths);
+// projection of the frame's Lidar points, computed on first use and then shared by all consumers of the frame
+const ProjectedLidarPoints &getProjectedLidarPoints(DataFrame &frame, const cv::Matx34f &lidarToImage);
 #endif /* lidarData_hpp */
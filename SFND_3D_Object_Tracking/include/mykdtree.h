@@ -1,101 +1,197 @@
 /* \author Aaron Brown */
 // Quiz on implementing kd tree
 
-
-
-
-// Structure to represent node of kd tree
-struct Node
-{
-	std::vector<float> point;
-	int id;
-	Node* left;
-	Node* right;
-
-	Node(std::vector<float> arr, int setId)
-	:	point(arr), id(setId), left(NULL), right(NULL)
-	{}
-};
-
+#ifndef mykdtree_h
+#define mykdtree_h
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// balanced kd tree over Dim dimensional points stored flat in tree order: the node of the range
+// [lo, hi) is its median at mid = (lo + hi) / 2, the children are the ranges [lo, mid) and
+// [mid + 1, hi). ranges of at most bucketSize points are leaves and are scanned linearly.
+// the radius search uses the exact euclidean distance over all Dim coordinates
+template <size_t Dim, typename Scalar = float>
 struct KdTree
 {
-	Node* root;
+	typedef std::array<Scalar, Dim> Point;
 
-	KdTree()
-	: root(NULL)
-	{}
+	static const int bucketSize = 16;
 
+	std::vector<int> ids;                  // point ids in tree order
+	std::vector<Scalar> coords[Dim];       // coordinates in tree order
+	std::vector<Scalar> buildCoords[Dim];  // coordinates in input order, only used while building
 
-	void insertHelper(Node** node, uint depth, const std::vector<float>& point, int id)
+	// build the tree over all points in O(n log n), the storage of the previous build is reused
+	void build(const std::vector<Point>& points)
 	{
-		if(*node == NULL)
+		int n = points.size();
+		ids.resize(n);
+		for(size_t k = 0; k < Dim; ++k)
 		{
-			*node = new Node(point, id);
+			buildCoords[k].resize(n);
+			coords[k].resize(n);
 		}
-		else 
+		for(int i = 0; i < n; ++i)
 		{
-			uint in = depth % 3; // even = movement in Y, odd = movement in X
-
-			if(point[in] < ((*node) -> point[in])){
-				insertHelper(&((*node)->left), depth + 1, point, id);
-			}
-			else{
-				insertHelper(&((*node)->right), depth + 1, point, id);
-			}
+			ids[i] = i;
+			for(size_t k = 0; k < Dim; ++k)
+				buildCoords[k][i] = points[i][k];
 		}
+
+		buildHelper(0, n, 0);
+
+		for(int i = 0; i < n; ++i)
+			for(size_t k = 0; k < Dim; ++k)
+				coords[k][i] = buildCoords[k][ids[i]];
 	}
 
-	void insert(const std::vector<float>& point, int id)
+	void buildHelper(int lo, int hi, int depth)
 	{
-		// TODO: Fill in this function to insert a new point into the tree
-		// the function should create a new node and place correctly with in the root 
-		insertHelper(&root, 0, point, id);
-
+		if(hi - lo <= bucketSize)
+			return;
 
+		int mid = (lo + hi) / 2;
+		const std::vector<Scalar>& c = buildCoords[depth % Dim];
+		std::nth_element(ids.begin() + lo, ids.begin() + mid, ids.begin() + hi,
+		                 [&c](int a, int b) { return c[a] < c[b]; });
 
+		buildHelper(lo, mid, depth + 1);
+		buildHelper(mid + 1, hi, depth + 1);
 	}
 
+	Scalar distanceSq(const Scalar* target, int i) const
+	{
+		Scalar distSq = 0;
+		for(size_t k = 0; k < Dim; ++k)
+		{
+			Scalar d = coords[k][i] - target[k];
+			distSq += d * d;
+		}
+		return distSq;
+	}
 
-	void searchHelper(const std::vector<float>& target, Node* node, int depth, float distanceTol, std::vector<int>& ids)
+	// append the ids of the leaf points in [lo, hi) which are within distance of target
+	void searchBucket(const Scalar* target, int lo, int hi, Scalar distanceTolSq, std::vector<int>& nearby) const
 	{
-		int in = depth % 3; // 2 = movement in Z, 1 = movement in Y, 0 = movement in X
-		//float insideBox = 2*distanceTol;
-		
-		if(node != NULL){
-
-			float dx = fabs(node->point[0] - target[0]);
-			float dy = fabs(node->point[1] - target[1]);
-
-			if(dx <= distanceTol && dy <= distanceTol) {
-				float distance = std::hypotf(dx, dy);
-				if(distance <= distanceTol){
-					ids.push_back((node->id));
+		int i = lo;
+#ifdef __AVX2__
+		if constexpr(std::is_same<Scalar, float>::value)
+		{
+			const __m256 tol = _mm256_set1_ps(distanceTolSq);
+			for(; i + 8 <= hi; i += 8)
+			{
+				__m256 distSq = _mm256_setzero_ps();
+				for(size_t k = 0; k < Dim; ++k)
+				{
+					__m256 d = _mm256_sub_ps(_mm256_loadu_ps(coords[k].data() + i), _mm256_set1_ps(target[k]));
+					distSq = _mm256_add_ps(distSq, _mm256_mul_ps(d, d));
 				}
+				unsigned mask = _mm256_movemask_ps(_mm256_cmp_ps(distSq, tol, _CMP_LE_OQ));
+				for(; mask; mask &= mask - 1)
+					nearby.push_back(ids[i + __builtin_ctz(mask)]);
 			}
+		}
+#endif
+		for(; i < hi; ++i)
+		{
+			if(distanceSq(target, i) <= distanceTolSq)
+				nearby.push_back(ids[i]);
+		}
+	}
 
-			if((target[in] - distanceTol) < node->point[in]){
-				searchHelper(target, node-> left, depth + 1, distanceTol, ids);
-		
-	
-			}
-			if(target[in] + distanceTol > node->point[in]){
-				searchHelper(target, node->right, depth+1, distanceTol, ids);
-			}
-				
+	void searchHelper(const Scalar* target, int lo, int hi, int depth, Scalar distanceTol, std::vector<int>& nearby) const
+	{
+		if(hi - lo <= bucketSize)
+		{
+			searchBucket(target, lo, hi, distanceTol * distanceTol, nearby);
+			return;
 		}
+
+		int mid = (lo + hi) / 2;
+		if(distanceSq(target, mid) <= distanceTol * distanceTol)
+			nearby.push_back(ids[mid]);
+
+		int in = depth % Dim;
+		Scalar split = coords[in][mid];
+		if(target[in] - distanceTol <= split)
+			searchHelper(target, lo, mid, depth + 1, distanceTol, nearby);
+		if(target[in] + distanceTol >= split)
+			searchHelper(target, mid + 1, hi, depth + 1, distanceTol, nearby);
 	}
 
-	// return a list of point ids in the tree that are within distance of target
-	std::vector<int> search(const std::vector<float>& target, float distanceTol)
+	// append the ids of the points in the tree that are within distance of target to nearby
+	void search(const Scalar* target, Scalar distanceTol, std::vector<int>& nearby) const
 	{
-		std::vector<int> ids;
-		searchHelper(target, root, 0, distanceTol, ids);
-		return ids;
+		searchHelper(target, 0, ids.size(), 0, distanceTol, nearby);
 	}
-	
 
-};
+	// offer a point to the bounded max-heap of the k nearest candidates found so far
+	static void offerNeighbor(std::vector<std::pair<Scalar, int>>& heap, int k, Scalar distSq, int id)
+	{
+		if((int)heap.size() < k)
+		{
+			heap.emplace_back(distSq, id);
+			std::push_heap(heap.begin(), heap.end());
+		}
+		else if(distSq < heap.front().first)
+		{
+			std::pop_heap(heap.begin(), heap.end());
+			heap.back() = std::make_pair(distSq, id);
+			std::push_heap(heap.begin(), heap.end());
+		}
+	}
 
+	void knnHelper(const Scalar* target, int lo, int hi, int depth, int k, std::vector<std::pair<Scalar, int>>& heap) const
+	{
+		if(hi - lo <= bucketSize)
+		{
+			for(int i = lo; i < hi; ++i)
+				offerNeighbor(heap, k, distanceSq(target, i), ids[i]);
+			return;
+		}
+
+		int mid = (lo + hi) / 2;
+		offerNeighbor(heap, k, distanceSq(target, mid), ids[mid]);
+
+		// descend into the side of the target first, the other side only when it can still hold a closer point
+		int in = depth % Dim;
+		Scalar diff = target[in] - coords[in][mid];
+		int nearLo = diff < 0 ? lo : mid + 1, nearHi = diff < 0 ? mid : hi;
+		int farLo = diff < 0 ? mid + 1 : lo, farHi = diff < 0 ? hi : mid;
+		knnHelper(target, nearLo, nearHi, depth + 1, k, heap);
+		if((int)heap.size() < k || diff * diff < heap.front().first)
+			knnHelper(target, farLo, farHi, depth + 1, k, heap);
+	}
 
+	// k nearest neighbors of target as (squared distance, id) pairs in ascending order of distance,
+	// the buffer of neighbors is reused between queries
+	void knnSearch(const Scalar* target, int k, std::vector<std::pair<Scalar, int>>& neighbors) const
+	{
+		neighbors.clear();
+		if(k <= 0)
+			return;
+		knnHelper(target, 0, ids.size(), 0, k, neighbors);
+		std::sort_heap(neighbors.begin(), neighbors.end());
+	}
+
+	// return a list of point ids in the tree that are within distance of target
+	std::vector<int> search(const Point& target, Scalar distanceTol) const
+	{
+		std::vector<int> nearby;
+		search(target.data(), distanceTol, nearby);
+		return nearby;
+	}
+};
 
+typedef KdTree<2> KdTree2D; // bird's eye view
+typedef KdTree<3> KdTree3D;
 
+#endif /* mykdtree_h */
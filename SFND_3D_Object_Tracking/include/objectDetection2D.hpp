@@ -3,10 +3,107 @@
 #define objectDetection2D_hpp
 
 #include <stdio.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
 #include <opencv2/core.hpp>
+#include <opencv2/dnn.hpp>
 
 #include "dataStructures.h"
 
+// YOLO detection session which loads class names, network and output layer names once and is then reused for every frame
+class ObjectDetector
+{
+public:
+    ObjectDetector(std::string classesFile, std::string modelConfiguration, std::string modelWeights,
+                   float confThreshold, float nmsThreshold, cv::Size inputSize = cv::Size(416, 416));
+
+    void detect(cv::Mat& img, std::vector<BoundingBox>& bBoxes, bool bVis=false);
+    // runs all images through the network in a single forward pass, bBoxes[i] receives the detections of imgs[i]
+    void detectBatch(const std::vector<cv::Mat>& imgs, std::vector<std::vector<BoundingBox>>& bBoxes);
+    void setThresholds(float confThreshold, float nmsThreshold);
+    void setInputSize(cv::Size inputSize);
+    // only boxes whose best class is in the list are kept, an empty list keeps all classes
+    void setClassFilter(const std::vector<int>& allowedClassIds);
+    // suppress overlapping boxes only within the same class instead of cv::dnn::NMSBoxes() across all classes
+    void setClassAwareNms(bool enable) { classAwareNms = enable; }
+
+    cv::Size getInputSize() const { return inputSize; }
+
+    const std::vector<std::string>& getClasses() const { return classes; }
+
+private:
+    void decodeOutput(int batchIdx, int batchSize, cv::Size imgSize, std::vector<BoundingBox>& bBoxes);
+    bool preprocess(const cv::Mat& img, float* dst);
+    void suppressNonMaximaPerClass();
+    void showDetections(cv::Mat& img, std::vector<BoundingBox>& bBoxes);
+
+    std::vector<std::string> classes; // class names from "coco.names"
+    std::vector<bool> classAllowed; // per class ID, empty if no class filter is set
+    bool classAwareNms;
+    cv::dnn::Net net;
+    std::vector<cv::String> outNames; // names of the unconnected output layers
+    cv::Mat blob; // 4D network input, allocated once and refilled for each frame
+    cv::Mat batchBlob; // NCHW input for detectBatch(), reallocated only when the batch size changes
+    std::vector<cv::Mat> netOutput;
+    cv::Size prepSrcSize; // image size the resize tables below were computed for
+    std::vector<int> prepX0, prepX1, prepY0, prepY1; // bilinear source columns (in bytes) and rows per output pixel
+    std::vector<float> prepWx, prepWy; // weight of the second column / row
+    std::vector<float> prepRows; // two horizontally resized source rows, one plane per channel
+    std::vector<int> classIds; // candidate boxes of the frame being decoded, kept to avoid reallocations
+    std::vector<float> confidences;
+    std::vector<cv::Rect> boxes;
+    std::vector<int> indices; // boxes surviving non-maxima suppression
+    std::vector<int> nmsOrder; // scratch buffers of suppressNonMaximaPerClass()
+    std::vector<float> nmsX1, nmsY1, nmsX2, nmsY2, nmsArea;
+    std::vector<unsigned char> nmsSuppressed;
+    cv::Size inputSize;
+    float confThreshold;
+    float nmsThreshold;
+};
+
+// one operating point of the adaptive detector: network and input resolution
+struct DetectorLevel
+{
+    std::string modelConfiguration;
+    std::string modelWeights;
+    cv::Size inputSize;
+};
+
+// runs YOLO on the level given by the caller and measures the inference time of every frame; whenever the running
+// average leaves the latency budget, it switches to a faster or more accurate level from the list
+class AdaptiveObjectDetector
+{
+public:
+    // levels are ordered from the most accurate (slowest) to the fastest one, throws cv::Exception without levels
+    AdaptiveObjectDetector(std::string classesFile, std::vector<DetectorLevel> levels, float confThreshold,
+                           float nmsThreshold, double latencyBudget, size_t startLevel = 0);
+
+    void detect(cv::Mat& img, std::vector<BoundingBox>& bBoxes, bool bVis=false);
+
+    void setClassFilter(const std::vector<int>& allowedClassIds);
+    void setClassAwareNms(bool enable);
+
+    const DetectorLevel& getCurrentLevel() const { return levels[currLevel]; }
+    double getAverageLatency() const { return avgLatency; }
+
+private:
+    ObjectDetector& getSession(const DetectorLevel& level);
+
+    std::string classesFile;
+    std::vector<DetectorLevel> levels;
+    std::map<std::string, std::unique_ptr<ObjectDetector>> sessions; // one loaded network per model, shared by all input sizes
+    float confThreshold;
+    float nmsThreshold;
+    std::vector<int> allowedClassIds;
+    bool classAwareNms;
+    double latencyBudget; // in [ms]
+    size_t currLevel;
+    double avgLatency; // exponential moving average of the inference time at the current level in [ms]
+    int framesAtLevel;
+};
+
 void detectObjects(cv::Mat& img, std::vector<BoundingBox>& bBoxes, float confThreshold, float nmsThreshold, 
                    std::string basePath, std::string classesFile, std::string modelConfiguration, std::string modelWeights, bool bVis);
 
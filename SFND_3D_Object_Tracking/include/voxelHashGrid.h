@@ -0,0 +1,126 @@
+#ifndef voxelHashGrid_h
+#define voxelHashGrid_h
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// fixed radius neighbor search over Dim dimensional points. the points are binned into cubic cells whose
+// edge is the search radius, so all neighbors of a point lie in the 3^Dim cells around its own cell. cells
+// are hashed into a table of buckets which is filled by a counting sort in O(n), the points of a bucket are
+// stored contiguously
+template <size_t Dim>
+class VoxelHashGrid
+{
+public:
+    typedef std::array<float, Dim> Point;
+
+    std::vector<int> ids; // point ids in bucket order
+
+    // bin all points into cells of edge cellSize, the storage of the previous build is reused
+    void build(const std::vector<Point> &points, float cellSize)
+    {
+        int n = points.size();
+        this->cellSize = cellSize;
+        invCellSize = 1.0f / cellSize;
+
+        // about two buckets per point keeps collisions between occupied cells rare
+        numBuckets = 1;
+        while (numBuckets < 2 * n)
+            numBuckets <<= 1;
+
+        bucketOfPoint.resize(n);
+        bucketStart.assign(numBuckets + 1, 0);
+        for (int i = 0; i < n; ++i)
+        {
+            bucketOfPoint[i] = bucketOf(cellOf(points[i].data()));
+            ++bucketStart[bucketOfPoint[i] + 1];
+        }
+        for (int b = 0; b < numBuckets; ++b)
+            bucketStart[b + 1] += bucketStart[b];
+
+        ids.resize(n);
+        for (size_t k = 0; k < Dim; ++k)
+            coords[k].resize(n);
+        fill.assign(bucketStart.begin(), bucketStart.end() - 1);
+        for (int i = 0; i < n; ++i)
+        {
+            int pos = fill[bucketOfPoint[i]]++;
+            ids[pos] = i;
+            for (size_t k = 0; k < Dim; ++k)
+                coords[k][pos] = points[i][k];
+        }
+    }
+
+    // append the ids of the points within distanceTol of target to nearby, distanceTol must not exceed the cell size
+    void search(const float *target, float distanceTol, std::vector<int> &nearby) const
+    {
+        if (ids.empty())
+            return;
+
+        // buckets of the 3^Dim surrounding cells, a bucket shared by several of them is only scanned once
+        std::array<int, ipow3(Dim)> buckets;
+        std::array<int, Dim> center = cellOf(target), cell;
+        for (int c = 0; c < ipow3(Dim); ++c)
+        {
+            for (size_t k = 0, rest = c; k < Dim; ++k, rest /= 3)
+                cell[k] = center[k] + int(rest % 3) - 1;
+            buckets[c] = bucketOf(cell);
+        }
+        std::sort(buckets.begin(), buckets.end());
+        auto bucketsEnd = std::unique(buckets.begin(), buckets.end());
+
+        float distanceTolSq = distanceTol * distanceTol;
+        for (auto b = buckets.begin(); b != bucketsEnd; ++b)
+        {
+            for (int i = bucketStart[*b]; i < bucketStart[*b + 1]; ++i)
+            {
+                float distSq = 0;
+                for (size_t k = 0; k < Dim; ++k)
+                {
+                    float d = coords[k][i] - target[k];
+                    distSq += d * d;
+                }
+                if (distSq <= distanceTolSq)
+                    nearby.push_back(ids[i]);
+            }
+        }
+    }
+
+    float getCellSize() const { return cellSize; }
+
+private:
+    static constexpr int ipow3(size_t e) { return e == 0 ? 1 : 3 * ipow3(e - 1); }
+
+    std::array<int, Dim> cellOf(const float *pt) const
+    {
+        std::array<int, Dim> cell;
+        for (size_t k = 0; k < Dim; ++k)
+            cell[k] = (int)std::floor(pt[k] * invCellSize);
+        return cell;
+    }
+
+    int bucketOf(const std::array<int, Dim> &cell) const
+    {
+        static const uint32_t primes[3] = {73856093u, 19349663u, 83492791u};
+        uint32_t h = 0;
+        for (size_t k = 0; k < Dim; ++k)
+            h ^= uint32_t(cell[k]) * primes[k % 3];
+        return h & (numBuckets - 1);
+    }
+
+    float cellSize = 1.0f, invCellSize = 1.0f;
+    int numBuckets = 1;
+    std::vector<int> bucketStart;    // points of bucket b are at bucketStart[b] ... bucketStart[b + 1] - 1
+    std::vector<float> coords[Dim];  // coordinates in bucket order
+    std::vector<int> bucketOfPoint;  // scratch buffers of the counting sort
+    std::vector<int> fill;
+};
+
+typedef VoxelHashGrid<2> VoxelHashGrid2D; // bird's eye view
+typedef VoxelHashGrid<3> VoxelHashGrid3D;
+
+#endif /* voxelHashGrid_h */
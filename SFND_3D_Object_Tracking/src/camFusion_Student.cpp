@@ -1,12 +1,16 @@
 
 #include <algorithm>
+#include <atomic>
+#include <climits>
 #include <cmath>
 #include <iostream>
 #include <numeric>
+#include <opencv2/core/utility.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
 #include "../include/camFusion.hpp"
+#include "../include/lidarData.hpp"
 
 using namespace std;
 
@@ -16,55 +20,150 @@ void clusterLidarWithROI(std::vector<BoundingBox> &boundingBoxes,
                          std::vector<LidarPoint> &lidarPoints,
                          float shrinkFactor, cv::Mat &P_rect_xx,
                          cv::Mat &R_rect_xx, cv::Mat &RT) {
+  clusterLidarWithROI(boundingBoxes, lidarPoints, shrinkFactor,
+                      computeLidarProjection(P_rect_xx, R_rect_xx, RT));
+}
+
+void clusterLidarWithROI(std::vector<BoundingBox> &boundingBoxes,
+                         std::vector<LidarPoint> &lidarPoints,
+                         float shrinkFactor, const cv::Matx34f &lidarToImage) {
+  // project all Lidar points into the camera in one batch
+  std::vector<cv::Point2f> pixels(lidarPoints.size());
+  std::vector<float> depths(lidarPoints.size());
+  projectLidarPoints(lidarToImage, lidarPoints.data(), lidarPoints.size(),
+                     pixels.data(), depths.data());
+
+  // shrink the boxes once and index them by image region
+  RoiGridIndex roiIndex;
+  roiIndex.build(boundingBoxes, shrinkFactor);
+
   // loop over all Lidar points and associate them to a 2D bounding box
-  cv::Mat X(4, 1, cv::DataType<double>::type);
-  cv::Mat Y(3, 1, cv::DataType<double>::type);
-
-  for (auto &lidarPoint : lidarPoints) {
-    // assemble vector for matrix-vector-multiplication
-    X.at<double>(0, 0) = (double)lidarPoint.x;
-    X.at<double>(1, 0) = (double)lidarPoint.y;
-    X.at<double>(2, 0) = (double)lidarPoint.z;
-    X.at<double>(3, 0) = 1.0;
-
-    // project Lidar point into camera
-    Y = P_rect_xx * R_rect_xx * RT * X;
-    cv::Point pt;
+  for (size_t i = 0; i < lidarPoints.size(); ++i) {
     // pixel coordinates
-    pt.x = (int)(Y.at<double>(0, 0) / Y.at<double>(2, 0));
-    pt.y = (int)(Y.at<double>(1, 0) / Y.at<double>(2, 0));
-
-    vector<vector<BoundingBox>::iterator>
-        enclosingBoxes; // pointers to all bounding boxes which enclose the
-                        // current Lidar point
-    for (auto it2 = boundingBoxes.begin(); it2 != boundingBoxes.end(); ++it2) {
-      // shrink current bounding box slightly to avoid having too many outlier
-      // points around the edges
-      cv::Rect smallerBox;
-      smallerBox.x =
-          (int)((*it2).roi.x + (double)shrinkFactor * (*it2).roi.width / 2.0);
-      smallerBox.y =
-          (int)((*it2).roi.y + (double)shrinkFactor * (*it2).roi.height / 2.0);
-      smallerBox.width = (int)((*it2).roi.width * (1.0 - (double)shrinkFactor));
-      smallerBox.height =
-          (int)((*it2).roi.height * (1.0 - (double)shrinkFactor));
-
-      // check wether point is within current bounding box
-      if (smallerBox.contains(pt)) {
-        enclosingBoxes.push_back(it2);
-      }
-
-    } // eof loop over all bounding boxes
+    cv::Point pt((int)pixels[i].x, (int)pixels[i].y);
 
-    // check wether point has been enclosed by one or by multiple boxes
-    if (enclosingBoxes.size() == 1) {
-      // add Lidar point to bounding box
-      enclosingBoxes[0]->lidarPoints.push_back(lidarPoint);
+    // add Lidar point to bounding box if it is enclosed by exactly one box
+    int boxIdx = roiIndex.findEnclosingBox(pt);
+    if (boxIdx >= 0) {
+      boundingBoxes[boxIdx].lidarPoints.push_back(lidarPoints[i]);
     }
+  } // eof loop over all Lidar points
+}
+
+// Same association for the Lidar points of a frame, the projection is taken
+// from the frame's cache and each box remembers the indices of its points so
+// that later consumers can look up their projections as well
+void clusterLidarWithROI(DataFrame &frame, float shrinkFactor,
+                         const cv::Matx34f &lidarToImage) {
+  const ProjectedLidarPoints &projection =
+      getProjectedLidarPoints(frame, lidarToImage);
+
+  // shrink the boxes once and index them by image region
+  RoiGridIndex roiIndex;
+  roiIndex.build(frame.boundingBoxes, shrinkFactor);
 
+  // loop over all Lidar points and associate them to a 2D bounding box
+  for (size_t i = 0; i < frame.lidarPoints.size(); ++i) {
+    // pixel coordinates
+    cv::Point pt((int)projection.pixels[i].x, (int)projection.pixels[i].y);
+
+    // add Lidar point to bounding box if it is enclosed by exactly one box
+    int boxIdx = roiIndex.findEnclosingBox(pt);
+    if (boxIdx >= 0) {
+      frame.boundingBoxes[boxIdx].lidarPoints.push_back(frame.lidarPoints[i]);
+      frame.boundingBoxes[boxIdx].lidarPointIndices.push_back((int)i);
+    }
   } // eof loop over all Lidar points
 }
 
+void RoiGridIndex::build(const std::vector<BoundingBox> &boundingBoxes,
+                         float shrinkFactor, int cellSize) {
+  this->cellSize = cellSize;
+  smallerBoxes.clear();
+  cellStart.clear();
+  cellBoxes.clear();
+  cols = rows = 0;
+  if (boundingBoxes.empty()) {
+    return;
+  }
+
+  // shrink each bounding box slightly to avoid having too many outlier points
+  // around the edges
+  cv::Point minCorner(INT_MAX, INT_MAX), maxCorner(INT_MIN, INT_MIN);
+  for (auto &box : boundingBoxes) {
+    cv::Rect smallerBox;
+    smallerBox.x =
+        (int)(box.roi.x + (double)shrinkFactor * box.roi.width / 2.0);
+    smallerBox.y =
+        (int)(box.roi.y + (double)shrinkFactor * box.roi.height / 2.0);
+    smallerBox.width = (int)(box.roi.width * (1.0 - (double)shrinkFactor));
+    smallerBox.height = (int)(box.roi.height * (1.0 - (double)shrinkFactor));
+    smallerBoxes.push_back(smallerBox);
+
+    minCorner.x = min(minCorner.x, smallerBox.x);
+    minCorner.y = min(minCorner.y, smallerBox.y);
+    maxCorner.x = max(maxCorner.x, smallerBox.x + smallerBox.width);
+    maxCorner.y = max(maxCorner.y, smallerBox.y + smallerBox.height);
+  }
+  origin = minCorner;
+  cols = (maxCorner.x - origin.x) / cellSize + 1;
+  rows = (maxCorner.y - origin.y) / cellSize + 1;
+
+  // count the boxes per cell, then fill the cells (counting sort)
+  auto forEachCell = [&](const cv::Rect &box, auto &&visit) {
+    if (box.width <= 0 || box.height <= 0) {
+      return;
+    }
+    int c0 = (box.x - origin.x) / cellSize;
+    int c1 = (box.x + box.width - 1 - origin.x) / cellSize;
+    int r0 = (box.y - origin.y) / cellSize;
+    int r1 = (box.y + box.height - 1 - origin.y) / cellSize;
+    for (int r = r0; r <= r1; ++r) {
+      for (int c = c0; c <= c1; ++c) {
+        visit(r * cols + c);
+      }
+    }
+  };
+  cellStart.assign(cols * rows + 1, 0);
+  for (auto &box : smallerBoxes) {
+    forEachCell(box, [&](int cell) { cellStart[cell + 1]++; });
+  }
+  for (size_t cell = 1; cell < cellStart.size(); ++cell) {
+    cellStart[cell] += cellStart[cell - 1];
+  }
+  cellBoxes.resize(cellStart.back());
+  std::vector<int> fill(cellStart.begin(), cellStart.end() - 1);
+  for (int boxIdx = 0; boxIdx < (int)smallerBoxes.size(); ++boxIdx) {
+    forEachCell(smallerBoxes[boxIdx],
+                [&](int cell) { cellBoxes[fill[cell]++] = boxIdx; });
+  }
+}
+
+int RoiGridIndex::findEnclosingBox(const cv::Point &pt) const {
+  int c = pt.x - origin.x, r = pt.y - origin.y;
+  if (c < 0 || r < 0) {
+    return -1;
+  }
+  c /= cellSize;
+  r /= cellSize;
+  if (c >= cols || r >= rows) {
+    return -1;
+  }
+
+  // check wether point has been enclosed by one or by multiple boxes
+  int enclosingBox = -1;
+  int cell = r * cols + c;
+  for (int k = cellStart[cell]; k < cellStart[cell + 1]; ++k) {
+    if (smallerBoxes[cellBoxes[k]].contains(pt)) {
+      if (enclosingBox >= 0) {
+        return -1;
+      }
+      enclosingBox = cellBoxes[k];
+    }
+  }
+  return enclosingBox;
+}
+
 /*
  * The show3DObjects() function below can handle different output image sizes,
  * but the text output has been manually tuned to fit the 2000x2000 size.
@@ -233,55 +332,189 @@ void computeTTCCamera(std::vector<cv::KeyPoint> &kptsPrev,
   cout << "TTC Camera: " << TTC << endl;
 }
 
-void clusterHelper(int i, std::vector<std::vector<float>> &points,
-                   std::vector<int> &cluster, std::vector<bool> &processed,
-                   KdTree *tree, float distanceTol) {
-  processed[i] = true;
-  cluster.push_back(i);
-  std::vector<int> nearbyPoints = tree->search(points[i], distanceTol);
-  for (int j : nearbyPoints) {
-    if (!processed[j]) {
-      clusterHelper(j, points, cluster, processed, tree, distanceTol);
+template <size_t Dim, typename NeighborIndex>
+std::vector<std::vector<int>>
+myEuclideanCluster(const std::vector<std::array<float, Dim>> &points,
+                   const NeighborIndex *tree, float distanceTol, int minSize,
+                   int maxSize) {
+  std::vector<std::vector<int>> clusters;
+  std::vector<bool> processed(points.size(), false);
+
+  // breadth first flood fill. every point enters the queue once, so all
+  // clusters share one preallocated queue and the members of the current
+  // cluster are queue[clusterStart] ... queue[tail - 1]
+  int numPoints = points.size();
+  std::vector<int> queue(numPoints);
+  std::vector<int> nearbyPoints;
+  int tail = 0;
+
+  for (int i = 0; i < numPoints; i++) {
+    if (processed[i])
+      continue;
+
+    int clusterStart = tail, head = tail;
+    processed[i] = true;
+    queue[tail++] = i;
+    while (head < tail) {
+      nearbyPoints.clear();
+      tree->search(points[queue[head++]].data(), distanceTol, nearbyPoints);
+      for (int j : nearbyPoints) {
+        if (!processed[j]) {
+          processed[j] = true;
+          queue[tail++] = j;
+        }
+      }
     }
+
+    // clusters outside of the size limits are dropped, their points are
+    // still consumed so they do not seed fragments of the same cluster
+    int clusterSize = tail - clusterStart;
+    if (clusterSize >= minSize && clusterSize <= maxSize)
+      clusters.emplace_back(queue.begin() + clusterStart, queue.begin() + tail);
   }
+
+  return clusters;
 }
 
-std::vector<std::vector<int>>
-myEuclideanCluster(std::vector<std::vector<float>> &points, KdTree *tree,
-                   float distanceTol) {
-  std::vector<std::vector<int>> clusters;
-  std::vector<bool> processed(points.size(), false);
+template std::vector<std::vector<int>>
+myEuclideanCluster(const std::vector<std::array<float, 2>> &points,
+                   const KdTree<2> *tree, float distanceTol, int minSize,
+                   int maxSize);
+template std::vector<std::vector<int>>
+myEuclideanCluster(const std::vector<std::array<float, 3>> &points,
+                   const KdTree<3> *tree, float distanceTol, int minSize,
+                   int maxSize);
+template std::vector<std::vector<int>>
+myEuclideanCluster(const std::vector<std::array<float, 2>> &points,
+                   const VoxelHashGrid<2> *grid, float distanceTol,
+                   int minSize, int maxSize);
+template std::vector<std::vector<int>>
+myEuclideanCluster(const std::vector<std::array<float, 3>> &points,
+                   const VoxelHashGrid<3> *grid, float distanceTol,
+                   int minSize, int maxSize);
+
+// root of the union-find tree of i, halves the path on the way up. every link
+// points to a smaller index, so the root is the smallest index of the set
+static int findRoot(std::vector<std::atomic<int>> &parent, int i) {
+  while (true) {
+    int p = parent[i].load(std::memory_order_relaxed);
+    if (p == i)
+      return i;
+    int gp = parent[p].load(std::memory_order_relaxed);
+    if (p != gp)
+      parent[i].compare_exchange_weak(p, gp, std::memory_order_relaxed);
+    i = gp;
+  }
+}
+
+// merge the sets of a and b by hanging the larger root below the smaller one,
+// retried when another thread relinked the root in the meantime
+static void uniteSets(std::vector<std::atomic<int>> &parent, int a, int b) {
+  while (true) {
+    a = findRoot(parent, a);
+    b = findRoot(parent, b);
+    if (a == b)
+      return;
+    if (a > b)
+      std::swap(a, b);
+    int expected = b;
+    if (parent[b].compare_exchange_strong(expected, a,
+                                          std::memory_order_relaxed))
+      return;
+  }
+}
 
-  for (int i = 0; i < points.size(); i++) {
-    if (!processed[i]) {
-      std::vector<int> cluster;
-      clusterHelper(i, points, cluster, processed, tree, distanceTol);
-      clusters.push_back(cluster);
+template <size_t Dim>
+std::vector<std::vector<int>>
+parallelEuclideanCluster(const std::vector<std::array<float, Dim>> &points,
+                         const KdTree<Dim> *tree, float distanceTol,
+                         int minSize, int maxSize) {
+  int numPoints = points.size();
+  std::vector<std::atomic<int>> parent(numPoints);
+  for (int i = 0; i < numPoints; i++)
+    parent[i].store(i, std::memory_order_relaxed);
+
+  // consecutive points in tree order are spatially close, so every stripe of
+  // the tree order is a compact partition of the cloud and most of its links
+  // stay within the partition
+  int numStripes = std::max(1, numPoints / parallelClusterStripeSize);
+  cv::parallel_for_(
+      cv::Range(0, numPoints),
+      [&](const cv::Range &range) {
+        std::vector<int> nearbyPoints;
+        for (int k = range.start; k < range.end; k++) {
+          int i = tree->ids[k];
+          nearbyPoints.clear();
+          tree->search(points[i].data(), distanceTol, nearbyPoints);
+          for (int j : nearbyPoints) {
+            if (j > i) // every pair is linked once
+              uniteSets(parent, i, j);
+          }
+        }
+      },
+      numStripes);
+
+  // the label of a point is the smallest index of its cluster, which does not
+  // depend on the number of threads. clusters are ordered by their label and
+  // list their points in ascending order
+  std::vector<int> clusterOfRoot(numPoints, -1);
+  std::vector<std::vector<int>> allClusters;
+  for (int i = 0; i < numPoints; i++) {
+    int root = findRoot(parent, i);
+    if (clusterOfRoot[root] < 0) {
+      clusterOfRoot[root] = allClusters.size();
+      allClusters.emplace_back();
     }
+    allClusters[clusterOfRoot[root]].push_back(i);
   }
 
+  std::vector<std::vector<int>> clusters;
+  for (auto &cluster : allClusters) {
+    int clusterSize = cluster.size();
+    if (clusterSize >= minSize && clusterSize <= maxSize)
+      clusters.push_back(std::move(cluster));
+  }
   return clusters;
 }
 
+template std::vector<std::vector<int>>
+parallelEuclideanCluster<2>(const std::vector<std::array<float, 2>> &points,
+                            const KdTree<2> *tree, float distanceTol,
+                            int minSize, int maxSize);
+template std::vector<std::vector<int>>
+parallelEuclideanCluster<3>(const std::vector<std::array<float, 3>> &points,
+                            const KdTree<3> *tree, float distanceTol,
+                            int minSize, int maxSize);
+
 std::vector<LidarPoint>
 filterOutliers(const std::vector<LidarPoint> &lidarPoints,
-               float clusterTolerance) {
-
-  // Filtering by distance to the average of the cluster
-  KdTree *tree = new KdTree;
-  std::vector<std::vector<float>> points;
-  int sumX = 0, sumY = 0, sumZ = 0;
-
-  for (int i = 0; i < lidarPoints.size(); i++) {
-    std::vector<float> point(
-        {lidarPoints[i].x, lidarPoints[i].y, lidarPoints[i].z});
-    sumY = sumY + lidarPoints[i].y;
-    points.push_back(point);
-    tree->insert(points[i], i);
+               float clusterTolerance, int minClusterSize,
+               NeighborSearch neighborSearch, LidarTTCWorkspace &workspace) {
+  if (lidarPoints.empty())
+    return {};
+
+  KdTree3D &tree = workspace.tree;
+  VoxelHashGrid3D &grid = workspace.grid;
+  std::vector<std::array<float, 3>> &points = workspace.points;
+  points.clear();
+  for (size_t i = 0; i < lidarPoints.size(); i++) {
+    points.push_back({(float)lidarPoints[i].x, (float)lidarPoints[i].y,
+                      (float)lidarPoints[i].z});
+  }
+  std::vector<std::vector<int>> clusterIndex;
+  if (neighborSearch == NeighborSearch::VOXEL_GRID) {
+    grid.build(points, clusterTolerance);
+    clusterIndex =
+        myEuclideanCluster(points, &grid, clusterTolerance, minClusterSize);
+  } else {
+    tree.build(points);
+    clusterIndex =
+        points.size() >= parallelClusterMinPoints
+            ? parallelEuclideanCluster(points, &tree, clusterTolerance,
+                                       minClusterSize)
+            : myEuclideanCluster(points, &tree, clusterTolerance,
+                                 minClusterSize);
   }
-  std::vector<std::vector<int>> clusterIndex =
-      myEuclideanCluster(points, tree, clusterTolerance);
-  sumY = sumY / lidarPoints.size();
 
   std::vector<LidarPoint> pointClustering;
 
@@ -293,40 +526,289 @@ filterOutliers(const std::vector<LidarPoint> &lidarPoints,
   return pointClustering;
 }
 
+std::vector<LidarPoint>
+removeLidarOutlier(const std::vector<LidarPoint> &lidarPoints,
+                   int numNeighbors, float stddevMult,
+                   LidarTTCWorkspace *workspace) {
+  int numPoints = lidarPoints.size();
+  if (numNeighbors <= 0 || numPoints <= numNeighbors)
+    return lidarPoints;
+
+  LidarTTCWorkspace localWorkspace;
+  if (workspace == nullptr)
+    workspace = &localWorkspace;
+  KdTree3D &tree = workspace->tree;
+  std::vector<std::array<float, 3>> &points = workspace->points;
+  points.resize(numPoints);
+  for (int i = 0; i < numPoints; i++)
+    points[i] = {lidarPoints[i].x, lidarPoints[i].y, lidarPoints[i].z};
+  tree.build(points);
+
+  // mean distance of every point to its neighbors, the query point itself is
+  // returned as its own nearest neighbor and skipped
+  std::vector<float> meanDist(numPoints);
+  cv::parallel_for_(cv::Range(0, numPoints), [&](const cv::Range &range) {
+    std::vector<std::pair<float, int>> neighbors;
+    for (int i = range.start; i < range.end; i++) {
+      tree.knnSearch(points[i].data(), numNeighbors + 1, neighbors);
+      float sum = 0;
+      int count = 0;
+      for (auto &neighbor : neighbors) {
+        if (neighbor.second != i && count < numNeighbors) {
+          sum += std::sqrt(neighbor.first);
+          count++;
+        }
+      }
+      meanDist[i] = sum / count;
+    }
+  });
+
+  double mean = 0, sqSum = 0;
+  for (float d : meanDist) {
+    mean += d;
+    sqSum += d * d;
+  }
+  mean /= numPoints;
+  double stddev = std::sqrt(std::max(0.0, sqSum / numPoints - mean * mean));
+  double maxMeanDist = mean + stddevMult * stddev;
+
+  std::vector<LidarPoint> inliers;
+  inliers.reserve(numPoints);
+  for (int i = 0; i < numPoints; i++) {
+    if (meanDist[i] <= maxMeanDist)
+      inliers.push_back(lidarPoints[i]);
+  }
+  return inliers;
+}
+
+// closest x of the ego-lane points which belong to a cluster of at least
+// minClusterSize points. seeds are taken in ascending x and a cluster is only
+// grown until it is large enough, so the work is bounded by the clusters in
+// front of the closest valid one
+double nearestClusterDistance(const std::vector<LidarPoint> &lidarPoints,
+                              double laneWidth, float clusterTolerance,
+                              int minClusterSize,
+                              LidarTTCWorkspace &workspace) {
+  VoxelHashGrid3D &grid = workspace.grid;
+  int numPoints = lidarPoints.size();
+  std::vector<std::array<float, 3>> &points = workspace.points;
+  points.resize(numPoints);
+  std::vector<int> seeds;
+  for (int i = 0; i < numPoints; i++) {
+    points[i] = {lidarPoints[i].x, lidarPoints[i].y, lidarPoints[i].z};
+    if (abs(lidarPoints[i].y) <= laneWidth / 2.0)
+      seeds.push_back(i);
+  }
+  if (seeds.empty())
+    return 10000;
+  grid.build(points, clusterTolerance);
+
+  // min heap on x, seeds are only ordered as far as they are popped
+  auto fartherSeed = [&lidarPoints](int a, int b) {
+    return lidarPoints[a].x > lidarPoints[b].x;
+  };
+  std::make_heap(seeds.begin(), seeds.end(), fartherSeed);
+  double closestX = lidarPoints[seeds.front()].x;
+
+  std::vector<bool> processed(numPoints, false);
+  std::vector<int> queue, nearbyPoints;
+  for (auto seedsEnd = seeds.end(); seedsEnd != seeds.begin(); --seedsEnd) {
+    std::pop_heap(seeds.begin(), seedsEnd, fartherSeed);
+    int seed = *(seedsEnd - 1);
+    if (processed[seed])
+      continue;
+
+    // points closer than the seed were consumed by clusters which are too
+    // small and not connected to it, so the seed is the closest point of its
+    // cluster
+    queue.assign(1, seed);
+    processed[seed] = true;
+    for (int head = 0; head < (int)queue.size(); head++) {
+      if ((int)queue.size() >= minClusterSize)
+        return lidarPoints[seed].x;
+      nearbyPoints.clear();
+      grid.search(points[queue[head]].data(), clusterTolerance, nearbyPoints);
+      for (int j : nearbyPoints) {
+        if (!processed[j]) {
+          processed[j] = true;
+          queue.push_back(j);
+        }
+      }
+    }
+    if ((int)queue.size() >= minClusterSize)
+      return lidarPoints[seed].x;
+  }
+
+  // no cluster is large enough, fall back to the closest ego-lane point
+  return closestX;
+}
+
+// percentile of the x coordinates of the ego-lane points, selected in linear
+// time without building any search structure
+double percentileDistance(const std::vector<LidarPoint> &lidarPoints,
+                          double laneWidth, double percentile,
+                          LidarTTCWorkspace &workspace) {
+  std::vector<float> &xs = workspace.xs;
+  xs.clear();
+  for (auto &it : lidarPoints) {
+    if (abs(it.y) <= laneWidth / 2.0)
+      xs.push_back(it.x);
+  }
+  if (xs.empty())
+    return 10000;
+
+  percentile = std::min(std::max(percentile, 0.0), 1.0);
+  size_t k = std::min(xs.size() - 1, (size_t)(percentile * (xs.size() - 1)));
+  std::nth_element(xs.begin(), xs.begin() + k, xs.end());
+  return xs[k];
+}
+
+double closestLidarDistance(const std::vector<LidarPoint> &lidarPoints,
+                            const LidarTTCOptions &options,
+                            LidarTTCWorkspace *workspace) {
+  LidarTTCWorkspace localWorkspace;
+  if (workspace == nullptr)
+    workspace = &localWorkspace;
+
+  if (options.estimator == LidarDistanceEstimator::NEAREST_CLUSTER)
+    return nearestClusterDistance(lidarPoints, options.laneWidth,
+                                  options.clusterTolerance,
+                                  options.minClusterSize, *workspace);
+  if (options.estimator == LidarDistanceEstimator::PERCENTILE)
+    return percentileDistance(lidarPoints, options.laneWidth,
+                              options.percentile, *workspace);
+
+  std::vector<LidarPoint> filteredPoints =
+      options.estimator == LidarDistanceEstimator::STATISTICAL_FILTER
+          ? removeLidarOutlier(lidarPoints, options.numNeighbors,
+                               options.stddevMult, workspace)
+          : filterOutliers(lidarPoints, options.clusterTolerance,
+                           options.minClusterSize, options.neighborSearch,
+                           *workspace);
+
+  double minX = 10000;
+  for (auto &it : filteredPoints) {
+    if (abs(it.y) <= options.laneWidth / 2.0) {
+      if (it.x < minX)
+        minX = it.x;
+    }
+  }
+  return minX;
+}
+
 void computeTTCLidar(std::vector<LidarPoint> &lidarPointsPrev,
                      std::vector<LidarPoint> &lidarPointsCurr, double frameRate,
-                     double &TTC) {
+                     double &TTC, const LidarTTCOptions &options,
+                     LidarTTCWorkspace *workspace) {
   double dt = 1 / frameRate;
-  double lanewidth = 4.0; // ego line of 4 meters is assumed
-  float clusterTolerance = 0.1;
   std::cout.flush();
 
-  double minPrev = 10000, minCurr = 10000;
+  LidarTTCWorkspace localWorkspace;
+  if (workspace == nullptr)
+    workspace = &localWorkspace;
+  double minPrev = closestLidarDistance(lidarPointsPrev, options, workspace);
+  double minCurr = closestLidarDistance(lidarPointsCurr, options, workspace);
 
-  std::vector<LidarPoint> lidarPointsPrevClustered =
-      filterOutliers(lidarPointsPrev, clusterTolerance);
-
-  std::vector<LidarPoint> lidarPointsCurrClustered =
-      filterOutliers(lidarPointsCurr, clusterTolerance);
+  TTC = minCurr * dt / (minPrev - minCurr);
+  cout << "MinXPrev: " << minPrev << " MinXCurr: " << minCurr << endl;
+  cout << "TTC from lidar is: " << TTC << endl;
+}
 
-  for (auto &it : lidarPointsPrevClustered) {
-    if (abs(it.y) <= lanewidth / 2.0) {
-      if (it.x < minPrev)
-        minPrev = it.x;
-    }
+// robust distance of the box, computed on first use and again when the
+// estimator changes
+static double boxLidarDistance(BoundingBox &box,
+                               const LidarTTCOptions &options,
+                               LidarTTCWorkspace *workspace) {
+  if (box.lidarDistance < 0 ||
+      box.lidarDistanceEstimator != (int)options.estimator) {
+    box.lidarDistance =
+        closestLidarDistance(box.lidarPoints, options, workspace);
+    box.lidarDistanceEstimator = (int)options.estimator;
   }
+  return box.lidarDistance;
+}
+
+void computeTTCLidar(BoundingBox &prevBB, BoundingBox &currBB,
+                     double frameRate, double &TTC,
+                     const LidarTTCOptions &options,
+                     LidarTTCWorkspace *workspace) {
+  double dt = 1 / frameRate;
+
+  LidarTTCWorkspace localWorkspace;
+  if (workspace == nullptr)
+    workspace = &localWorkspace;
+  double minPrev = boxLidarDistance(prevBB, options, workspace);
+  double minCurr = boxLidarDistance(currBB, options, workspace);
 
-  for (auto &it : lidarPointsCurrClustered) {
-    if (abs(it.y) <= lanewidth / 2.0) {
-      if (it.x < minCurr)
-        minCurr = it.x;
-    }
-  }
   TTC = minCurr * dt / (minPrev - minCurr);
   cout << "MinXPrev: " << minPrev << " MinXCurr: " << minCurr << endl;
   cout << "TTC from lidar is: " << TTC << endl;
 }
 
+void LidarTTCRegression::addSample(int trackID, double t, double distance) {
+  auto it = tracks.find(trackID);
+  if (it == tracks.end()) {
+    it = tracks.emplace(trackID, Track()).first;
+    it->second.t0 = t;
+  }
+  Track &track = it->second;
+
+  // a box matched twice in the same frame only contributes once
+  cv::Point2d sample(t - track.t0, distance);
+  if (!track.samples.empty() && sample.x <= track.samples.back().x)
+    return;
+  track.samples.push_back(sample);
+  track.sumT += sample.x;
+  track.sumD += sample.y;
+  track.sumTT += sample.x * sample.x;
+  track.sumTD += sample.x * sample.y;
+
+  // the oldest sample leaves the window
+  if ((int)track.samples.size() > windowSize) {
+    cv::Point2d old = track.samples.front();
+    track.samples.pop_front();
+    track.sumT -= old.x;
+    track.sumD -= old.y;
+    track.sumTT -= old.x * old.x;
+    track.sumTD -= old.x * old.y;
+  }
+}
+
+bool LidarTTCRegression::estimateTTC(int trackID, double &TTC) const {
+  auto it = tracks.find(trackID);
+  if (it == tracks.end() || it->second.samples.size() < 2)
+    return false;
+  const Track &track = it->second;
+
+  // distance = offset + velocity * t
+  double n = track.samples.size();
+  double det = n * track.sumTT - track.sumT * track.sumT;
+  if (det <= 0)
+    return false;
+  double velocity = (n * track.sumTD - track.sumT * track.sumD) / det;
+  double offset = (track.sumD - velocity * track.sumT) / n;
+  if (velocity == 0)
+    return false;
+
+  double distance = offset + velocity * track.samples.back().x;
+  TTC = -distance / velocity;
+  return true;
+}
+
+int LidarTTCRegression::numSamples(int trackID) const {
+  auto it = tracks.find(trackID);
+  return it == tracks.end() ? 0 : it->second.samples.size();
+}
+
+void LidarTTCRegression::removeTracksBefore(double t) {
+  for (auto it = tracks.begin(); it != tracks.end();) {
+    if (it->second.t0 + it->second.samples.back().x < t)
+      it = tracks.erase(it);
+    else
+      ++it;
+  }
+}
+
 void matchBoundingBoxes(std::vector<cv::DMatch> &matches,
                         std::map<int, int> &bbBestMatches, DataFrame &prevFrame,
                         DataFrame &currFrame) {
@@ -367,4 +849,93 @@ void matchBoundingBoxes(std::vector<cv::DMatch> &matches,
     std::cout << "ID Match: " << prevBox.boxID << " => " << arg_max
               << " Size: " << prevBox.kptMatches.size() << std::endl;
   }
-}
\ No newline at end of file
+}
+
+// median of the given values, the order of the vector is changed
+static float medianOf(std::vector<float> &values) {
+  auto mid = values.begin() + values.size() / 2;
+  std::nth_element(values.begin(), mid, values.end());
+  return *mid;
+}
+
+// Predicts the bounding boxes of the current frame from those of the previous
+// frame when no detection is run: each box is moved by the median displacement
+// of the keypoint matches it encloses and scaled by the median change of their
+// distance to the matches' median point. boxID, trackID, classID and
+// confidence are carried over, so the boxes can be matched and tracked exactly
+// like detected ones. Returns the number of boxes which were supported by fewer
+// than minMatches matches, i.e. whose tracking is no longer reliable.
+int propagateBoundingBoxes(std::vector<cv::DMatch> &matches,
+                           DataFrame &prevFrame, DataFrame &currFrame,
+                           int minMatches) {
+  const float minSpread = 5.0f; // matches closer than this to the median point
+                                // in [px] are too noisy for the scale estimate
+  int weakBoxes = 0;
+  std::vector<cv::Point2f> ptsPrev, ptsCurr;
+  std::vector<float> xs, ys, scales;
+
+  currFrame.boundingBoxes.clear();
+  for (auto &prevBox : prevFrame.boundingBoxes) {
+    ptsPrev.clear();
+    ptsCurr.clear();
+    for (auto &match : matches) {
+      auto &prevKpt = prevFrame.keypoints[match.queryIdx].pt;
+      if (prevBox.roi.contains(prevKpt)) {
+        ptsPrev.push_back(prevKpt);
+        ptsCurr.push_back(currFrame.keypoints[match.trainIdx].pt);
+      }
+    }
+
+    BoundingBox currBox;
+    currBox.boxID = prevBox.boxID;
+    currBox.trackID = prevBox.trackID;
+    currBox.classID = prevBox.classID;
+    currBox.confidence = prevBox.confidence;
+    currBox.roi = prevBox.roi;
+
+    if ((int)ptsPrev.size() < minMatches || ptsPrev.empty()) {
+      // keep the box in place so that box IDs stay contiguous
+      weakBoxes++;
+      currFrame.boundingBoxes.push_back(currBox);
+      continue;
+    }
+
+    // median point of the matches in both frames
+    xs.clear();
+    ys.clear();
+    for (auto &pt : ptsPrev) {
+      xs.push_back(pt.x);
+      ys.push_back(pt.y);
+    }
+    cv::Point2f medPrev(medianOf(xs), medianOf(ys));
+    xs.clear();
+    ys.clear();
+    for (auto &pt : ptsCurr) {
+      xs.push_back(pt.x);
+      ys.push_back(pt.y);
+    }
+    cv::Point2f medCurr(medianOf(xs), medianOf(ys));
+
+    // scale change from the distances to the median point
+    scales.clear();
+    for (size_t i = 0; i < ptsPrev.size(); ++i) {
+      double distPrev = cv::norm(ptsPrev[i] - medPrev);
+      if (distPrev > minSpread) {
+        scales.push_back((float)(cv::norm(ptsCurr[i] - medCurr) / distPrev));
+      }
+    }
+    float scale = scales.empty() ? 1.0f : medianOf(scales);
+
+    // move the box center along with the median point and scale its size
+    float cx = prevBox.roi.x + prevBox.roi.width / 2.0f;
+    float cy = prevBox.roi.y + prevBox.roi.height / 2.0f;
+    float width = prevBox.roi.width * scale;
+    float height = prevBox.roi.height * scale;
+    cx = medCurr.x + scale * (cx - medPrev.x);
+    cy = medCurr.y + scale * (cy - medPrev.y);
+    currBox.roi = cv::Rect((int)(cx - width / 2.0f), (int)(cy - height / 2.0f),
+                           (int)width, (int)height);
+    currFrame.boundingBoxes.push_back(currBox);
+  }
+  return weakBoxes;
+}
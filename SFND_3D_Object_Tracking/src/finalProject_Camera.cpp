@@ -1,10 +1,13 @@
 
 /* INCLUDES FOR THIS PROJECT */
 #include <cmath>
+#include <cstdlib>
+#include <deque>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <limits>
+#include <memory>
 #include <opencv2/core.hpp>
 #include <opencv2/features2d.hpp>
 #include <opencv2/highgui/highgui.hpp>
@@ -48,11 +51,103 @@ int main(int argc, const char *argv[]) {
   // no. of digits which make up the file index (e.g. img-0001.png)
   int imgFillWidth = 4;
 
-  // object detection
+  // object detection, model and input size are runtime options:
+  //   --yolo-model yolov3|yolov3-tiny   --yolo-input <multiple of 32>
+  //   --latency-budget <ms>  adapts model and input size to the budget, the
+  //                          input size must then be one of 320|416|608
+  //   --batch-size <n>       images per YOLO forward pass, not combined with
+  //                          --latency-budget
+  // Lidar distance estimation, see LidarDistanceEstimator and NeighborSearch:
+  //   --lidar-estimator nearest-cluster|statistical-filter|cluster-filter|
+  //                     percentile
+  //   --lidar-search kd-tree|voxel-grid  search structure of cluster-filter,
+  //                     kd-tree clusters large boxes in parallel
+  string yoloModel = "yolov3";
+  int yoloInputSize = 416;
+  double yoloLatencyBudget = 0.0; // in [ms], 0 disables the adaptive mode
+  int yoloBatchSize = 1;
+  LidarTTCOptions lidarTTCOptions;
+  for (int i = 1; i < argc; i += 2) {
+    string option = argv[i];
+    if (i + 1 >= argc) {
+      cerr << "Missing value for option " << option << endl;
+      return 1;
+    }
+    string value = argv[i + 1];
+    char *end;
+    if (option == "--yolo-model") {
+      if (value != "yolov3" && value != "yolov3-tiny") {
+        cerr << "Unknown YOLO model " << value
+             << ", expected yolov3 or yolov3-tiny" << endl;
+        return 1;
+      }
+      yoloModel = value;
+    } else if (option == "--yolo-input") {
+      long size = strtol(value.c_str(), &end, 10);
+      if (value.empty() || *end != '\0' || size <= 0 || size % 32 != 0 ||
+          size > numeric_limits<int>::max()) {
+        cerr << "Invalid YOLO input size " << value
+             << ", expected a positive multiple of 32" << endl;
+        return 1;
+      }
+      yoloInputSize = (int)size;
+    } else if (option == "--latency-budget") {
+      yoloLatencyBudget = strtod(value.c_str(), &end);
+      if (value.empty() || *end != '\0' || !(yoloLatencyBudget > 0.0)) {
+        cerr << "Invalid latency budget " << value
+             << ", expected a positive number of milliseconds" << endl;
+        return 1;
+      }
+    } else if (option == "--batch-size") {
+      long size = strtol(value.c_str(), &end, 10);
+      if (value.empty() || *end != '\0' || size <= 0 ||
+          size > numeric_limits<int>::max()) {
+        cerr << "Invalid batch size " << value
+             << ", expected a positive integer" << endl;
+        return 1;
+      }
+      yoloBatchSize = (int)size;
+    } else if (option == "--lidar-estimator") {
+      if (value == "nearest-cluster")
+        lidarTTCOptions.estimator = LidarDistanceEstimator::NEAREST_CLUSTER;
+      else if (value == "statistical-filter")
+        lidarTTCOptions.estimator = LidarDistanceEstimator::STATISTICAL_FILTER;
+      else if (value == "cluster-filter")
+        lidarTTCOptions.estimator = LidarDistanceEstimator::CLUSTER_FILTER;
+      else if (value == "percentile")
+        lidarTTCOptions.estimator = LidarDistanceEstimator::PERCENTILE;
+      else {
+        cerr << "Unknown Lidar estimator " << value
+             << ", expected nearest-cluster, statistical-filter, "
+                "cluster-filter or percentile"
+             << endl;
+        return 1;
+      }
+    } else if (option == "--lidar-search") {
+      if (value == "kd-tree")
+        lidarTTCOptions.neighborSearch = NeighborSearch::KD_TREE;
+      else if (value == "voxel-grid")
+        lidarTTCOptions.neighborSearch = NeighborSearch::VOXEL_GRID;
+      else {
+        cerr << "Unknown Lidar search " << value
+             << ", expected kd-tree or voxel-grid" << endl;
+        return 1;
+      }
+    } else {
+      cerr << "Unknown option " << option << endl;
+      return 1;
+    }
+  }
+  if (yoloLatencyBudget > 0.0 && yoloBatchSize > 1) {
+    // the adaptive detector measures and adapts the latency per frame
+    cerr << "--batch-size cannot be combined with --latency-budget" << endl;
+    return 1;
+  }
+
   string yoloBasePath = dataPath + "dat/yolo/";
   string yoloClassesFile = yoloBasePath + "coco.names";
-  string yoloModelConfiguration = yoloBasePath + "yolov3.cfg";
-  string yoloModelWeights = yoloBasePath + "yolov3.weights";
+  string yoloModelConfiguration = yoloBasePath + yoloModel + ".cfg";
+  string yoloModelWeights = yoloBasePath + yoloModel + ".weights";
 
   // Lidar
   string lidarPrefix = "KITTI/2011_09_26/velodyne_points/data/000000";
@@ -74,6 +169,8 @@ int main(int argc, const char *argv[]) {
   cv::Mat P_rect_00 =
       (cv::Mat_<double>(3, 4) << 7.215377e+02, 0.0, 6.095593e+02, 0.0, 0.0,
        7.215377e+02, 1.728540e+02, 0.0, 0.0, 0.0, 1.0, 0.0);
+  // combined Lidar-to-image projection, only computed once
+  cv::Matx34f lidarToImage = computeLidarProjection(P_rect_00, R_rect_00, RT);
 
   // misc
   double sensorFrameRate =
@@ -89,6 +186,79 @@ int main(int argc, const char *argv[]) {
   float timeCount = 0.0;
   int matchedCount = 0;
 
+  // load the YOLO network once, it is reused for every frame
+  float confThreshold = 0.2;
+  float nmsThreshold = 0.4;
+  // the TTC computation only needs vehicles, so all other COCO classes are
+  // dropped before non-maxima suppression
+  vector<int> vehicleClassIds = {1, 2, 3, 5, 7}; // bicycle, car, motorbike,
+                                                  // bus, truck
+  unique_ptr<ObjectDetector> detector;
+  unique_ptr<AdaptiveObjectDetector> adaptiveDetector;
+  // no. of images which are run through YOLO in one forward pass, values > 1
+  // are meant for offline reprocessing of recorded sequences
+  size_t detectionBatchSize = yoloBatchSize;
+  if (yoloLatencyBudget > 0.0) {
+    // operating points from the most accurate to the fastest one, starting
+    // at the model and input size selected on the command line
+    vector<DetectorLevel> yoloLevels;
+    size_t yoloStartLevel = 0;
+    bool bStartLevelFound = false;
+    for (string model : {"yolov3", "yolov3-tiny"}) {
+      for (int size : {608, 416, 320}) {
+        if (model == yoloModel && size == yoloInputSize) {
+          yoloStartLevel = yoloLevels.size();
+          bStartLevelFound = true;
+        }
+        yoloLevels.push_back({yoloBasePath + model + ".cfg",
+                              yoloBasePath + model + ".weights",
+                              cv::Size(size, size)});
+      }
+    }
+    if (!bStartLevelFound) {
+      cerr << "With --latency-budget the YOLO input size must be 608, 416 or "
+              "320, got "
+           << yoloInputSize << endl;
+      return 1;
+    }
+    adaptiveDetector.reset(new AdaptiveObjectDetector(
+        yoloClassesFile, yoloLevels, confThreshold, nmsThreshold,
+        yoloLatencyBudget, yoloStartLevel));
+    adaptiveDetector->setClassFilter(vehicleClassIds);
+    adaptiveDetector->setClassAwareNms(true);
+  } else {
+    detector.reset(new ObjectDetector(
+        yoloClassesFile, yoloModelConfiguration, yoloModelWeights,
+        confThreshold, nmsThreshold, cv::Size(yoloInputSize, yoloInputSize)));
+    detector->setClassFilter(vehicleClassIds);
+    detector->setClassAwareNms(true);
+  }
+  deque<DataFrame> detectedFrames; // frames which have been loaded and
+                                   // detected ahead of the main loop
+  // YOLO only runs on every k-th frame, the boxes of the frames in between are
+  // propagated with the keypoint matches (not used in batched mode)
+  int detectionInterval = 1;
+  int minPropagationMatches = 10; // boxes with less matches trigger detection
+  int framesSinceDetection = 0;
+  bool bForceDetection = false;
+
+  // RANSAC road plane removal, replaces the fixed z band of the Lidar crop
+  bool bGroundRemoval = false;
+  float minHeight = 0.25, maxHeight = 0.85; // kept band above the road in [m]
+  GroundPlaneSegmenter groundSegmenter;
+  LidarCloud groundCloud, croppedCloud;
+
+  // reusable buffers of the Lidar distance estimation, the settings are
+  // parsed from the command line
+  LidarTTCWorkspace lidarTTCWorkspace;
+
+  // Lidar TTC from a least-squares fit over the last frames of each track
+  // instead of the distances of the last two frames only
+  bool bLidarTTCRegression = true;
+  int lidarTTCWindowSize = 5; // frames
+  LidarTTCRegression lidarTTCRegression(lidarTTCWindowSize);
+  int nextTrackID = 0;
+
   /* MAIN LOOP OVER ALL IMAGES */
 
   for (size_t imgIndex = 0; imgIndex <= imgEndIndex - imgStartIndex;
@@ -101,12 +271,40 @@ int main(int argc, const char *argv[]) {
     string imgFullFilename =
         imgBasePath + imgPrefix + imgNumber.str() + imgFileType;
 
-    // load image from file
-    cv::Mat img = cv::imread(imgFullFilename);
+    DataFrame frame;
+    if (detectionBatchSize > 1) {
+      if (detectedFrames.empty()) {
+        // load the next batch of images and detect objects in all of them
+        // with a single forward pass
+        vector<cv::Mat> batchImgs;
+        for (size_t i = imgIndex;
+             i <= (size_t)(imgEndIndex - imgStartIndex) &&
+             batchImgs.size() < detectionBatchSize;
+             i += imgStepWidth) {
+          ostringstream batchImgNumber;
+          batchImgNumber << setfill('0') << setw(imgFillWidth)
+                         << imgStartIndex + i;
+          batchImgs.push_back(cv::imread(imgBasePath + imgPrefix +
+                                         batchImgNumber.str() + imgFileType));
+        }
+
+        vector<vector<BoundingBox>> batchBoxes;
+        detector->detectBatch(batchImgs, batchBoxes);
+        for (size_t i = 0; i < batchImgs.size(); ++i) {
+          DataFrame batchFrame;
+          batchFrame.cameraImg = batchImgs[i];
+          batchFrame.boundingBoxes = batchBoxes[i];
+          detectedFrames.push_back(batchFrame);
+        }
+      }
+      frame = detectedFrames.front();
+      detectedFrames.pop_front();
+    } else {
+      // load image from file
+      frame.cameraImg = cv::imread(imgFullFilename);
+    }
 
     // push image into data frame buffer
-    DataFrame frame;
-    frame.cameraImg = img;
     dataBuffer.push_back(frame);
 
     if (dataBuffer.size() > dataBufferSize) {
@@ -118,13 +316,24 @@ int main(int argc, const char *argv[]) {
 
     /* DETECT & CLASSIFY OBJECTS */
 
-    float confThreshold = 0.2;
-    float nmsThreshold = 0.4;
+    bool bDetectFrame = detectionBatchSize > 1 || dataBuffer.size() < 2 ||
+                        bForceDetection ||
+                        framesSinceDetection + 1 >= detectionInterval;
+    framesSinceDetection = bDetectFrame ? 0 : framesSinceDetection + 1;
     bVis = false;
-    detectObjects((dataBuffer.end() - 1)->cameraImg,
-                  (dataBuffer.end() - 1)->boundingBoxes, confThreshold,
-                  nmsThreshold, yoloBasePath, yoloClassesFile,
-                  yoloModelConfiguration, yoloModelWeights, bVis);
+    // on skipped frames, the boxes are propagated once keypoint matches exist
+    if (bDetectFrame && adaptiveDetector) {
+      adaptiveDetector->detect((dataBuffer.end() - 1)->cameraImg,
+                               (dataBuffer.end() - 1)->boundingBoxes, bVis);
+      cout << "YOLO " << adaptiveDetector->getCurrentLevel().modelConfiguration
+           << " @ " << adaptiveDetector->getCurrentLevel().inputSize.width
+           << ", avg. latency " << adaptiveDetector->getAverageLatency()
+           << " ms" << endl;
+    } else if (bDetectFrame && detectionBatchSize <= 1) { // batched frames
+                                                          // arrive detected
+      detector->detect((dataBuffer.end() - 1)->cameraImg,
+                       (dataBuffer.end() - 1)->boundingBoxes, bVis);
+    }
 
     cout << "#2 : DETECT & CLASSIFY OBJECTS done" << endl;
 
@@ -133,15 +342,51 @@ int main(int argc, const char *argv[]) {
     // load 3D Lidar points from file
     string lidarFullFilename =
         imgBasePath + lidarPrefix + imgNumber.str() + lidarFileType;
-    std::vector<LidarPoint> lidarPoints;
-    loadLidarFromFile(lidarPoints, lidarFullFilename);
-
-    // remove Lidar points based on distance properties
+    // remove Lidar points based on distance properties while loading them,
+    // only the points which pass are written into the current frame
     float minZ = -1.5, maxZ = -0.9, minX = 2.0, maxX = 20.0, maxY = 2.0,
           minR = 0.1; // focus on ego lane
-    cropLidarPoints(lidarPoints, minX, maxX, maxY, minZ, maxZ, minR);
+    std::vector<LidarPoint> &framePoints = (dataBuffer.end() - 1)->lidarPoints;
+    bool bLidarLoaded;
+    if (bGroundRemoval) {
+      // keep the road and everything up to the sensor height in the cloud, fit
+      // the road and only keep the points within a height band above it, so
+      // that neither z bound is fixed on a sloped road
+      float groundMinZ = -3.0, groundMaxZ = 0.0;
+      bLidarLoaded =
+          loadCroppedLidarFromFile(framePoints, lidarFullFilename, minX, maxX,
+                                   maxY, groundMinZ, groundMaxZ, minR);
+      groundCloud.assign(framePoints);
+      framePoints.clear();
+      if (groundSegmenter.fitPlane(groundCloud)) {
+        groundSegmenter.removeGround(groundCloud, framePoints, minHeight,
+                                     maxHeight);
+      } else {
+        // no plane, fall back to the fixed z band
+        cropLidarCloud(groundCloud, croppedCloud, minX, maxX, maxY, minZ, maxZ,
+                       minR);
+        framePoints = croppedCloud.toPoints();
+      }
+    } else {
+      bLidarLoaded =
+          loadCroppedLidarFromFile(framePoints, lidarFullFilename, minX, maxX,
+                                   maxY, minZ, maxZ, minR);
+    }
+    if (!bLidarLoaded) {
+      // every later frame would be compared against a frame without Lidar
+      // points, so the sequence cannot be processed any further
+      cerr << "Could not read Lidar file " << lidarFullFilename
+           << ", aborting" << endl;
+      return 1;
+    }
 
-    (dataBuffer.end() - 1)->lidarPoints = lidarPoints;
+    // optionally thin out dense clouds before they are associated and clustered
+    bool bVoxelFilter = false;
+    float voxelLeafSize = 0.05; // edge length of a voxel in [m]
+    if (bVoxelFilter) {
+      downsampleLidarPoints((dataBuffer.end() - 1)->lidarPoints, voxelLeafSize,
+                            VoxelRepresentative::MIN_X);
+    }
 
     cout << "#3 : CROP LIDAR POINTS done" << endl;
 
@@ -151,9 +396,9 @@ int main(int argc, const char *argv[]) {
     float shrinkFactor =
         0.10; // shrinks each bounding box by the given percentage to avoid 3D
               // object merging at the edges of an ROI
-    clusterLidarWithROI((dataBuffer.end() - 1)->boundingBoxes,
-                        (dataBuffer.end() - 1)->lidarPoints, shrinkFactor,
-                        P_rect_00, R_rect_00, RT);
+    if (bDetectFrame) {
+      clusterLidarWithROI(*(dataBuffer.end() - 1), shrinkFactor, lidarToImage);
+    }
     // Visualize 3D objects
     bVis = false;
     if (bVis) {
@@ -253,6 +498,22 @@ int main(int argc, const char *argv[]) {
 
       cout << "#7 : MATCH KEYPOINT DESCRIPTORS done" << endl;
 
+      if (!bDetectFrame) {
+        // no detection on this frame, move the previous boxes along with the
+        // keypoint matches and associate the Lidar points with them instead
+        int weakBoxes = propagateBoundingBoxes(
+            matches, *(dataBuffer.end() - 2), *(dataBuffer.end() - 1),
+            minPropagationMatches);
+        bForceDetection = weakBoxes > 0;
+        clusterLidarWithROI(*(dataBuffer.end() - 1), shrinkFactor,
+                            lidarToImage);
+
+        cout << "#7b: PROPAGATE BOUNDING BOXES done, weak boxes: " << weakBoxes
+             << endl;
+      } else {
+        bForceDetection = false;
+      }
+
       //* TRACK 3D OBJECT BOUNDING BOXES
 
       //// STUDENT ASSIGNMENT
@@ -270,6 +531,30 @@ int main(int argc, const char *argv[]) {
       // store matches in current data frame
       (dataBuffer.end() - 1)->bbMatches = bbBestMatches;
 
+      // a matched box continues the track of its previous box, all other
+      // boxes start a new track
+      for (auto &bbMatch : bbBestMatches) {
+        for (auto &prevBox : (dataBuffer.end() - 2)->boundingBoxes) {
+          if (prevBox.boxID != bbMatch.first)
+            continue;
+          if (prevBox.trackID < 0)
+            prevBox.trackID = nextTrackID++;
+          for (auto &currBox : (dataBuffer.end() - 1)->boundingBoxes) {
+            if (currBox.boxID == bbMatch.second && currBox.trackID < 0)
+              currBox.trackID = prevBox.trackID;
+          }
+        }
+      }
+      for (auto &currBox : (dataBuffer.end() - 1)->boundingBoxes) {
+        if (currBox.trackID < 0)
+          currBox.trackID = nextTrackID++;
+      }
+
+      // tracks which were not seen within the regression window are dropped
+      double frameTime = (imgIndex / imgStepWidth) / sensorFrameRate;
+      lidarTTCRegression.removeTracksBefore(frameTime -
+                                            lidarTTCWindowSize / sensorFrameRate);
+
       cout << "#8 : TRACK 3D OBJECT BOUNDING BOXES done, size: "
            << bbBestMatches.size() << endl;
 
@@ -315,8 +600,23 @@ int main(int argc, const char *argv[]) {
             ///(implement -> computeTTCLidar)
             double ttcLidar;
 
-            computeTTCLidar(prevBB->lidarPoints, currBB->lidarPoints,
-                            sensorFrameRate, ttcLidar);
+            computeTTCLidar(*prevBB, *currBB, sensorFrameRate, ttcLidar,
+                            lidarTTCOptions, &lidarTTCWorkspace);
+            if (bLidarTTCRegression) {
+              // both distances are cached on the boxes by computeTTCLidar
+              if (lidarTTCRegression.numSamples(currBB->trackID) == 0)
+                lidarTTCRegression.addSample(currBB->trackID,
+                                             frameTime - 1 / sensorFrameRate,
+                                             prevBB->lidarDistance);
+              lidarTTCRegression.addSample(currBB->trackID, frameTime,
+                                           currBB->lidarDistance);
+              double ttcLidarFit;
+              if (lidarTTCRegression.estimateTTC(currBB->trackID,
+                                                 ttcLidarFit)) {
+                ttcLidar = ttcLidarFit;
+                cout << "TTC from lidar fit is: " << ttcLidar << endl;
+              }
+            }
             //// EOF STUDENT ASSIGNMENT
 
             //// STUDENT ASSIGNMENT
@@ -338,8 +638,8 @@ int main(int argc, const char *argv[]) {
             bVis = true;
             if (bVis) {
               cv::Mat visImg = (dataBuffer.end() - 1)->cameraImg.clone();
-              showLidarImgOverlay(visImg, currBB->lidarPoints, P_rect_00,
-                                  R_rect_00, RT, &visImg);
+              showLidarImgOverlay(visImg, *(dataBuffer.end() - 1), *currBB,
+                                  lidarToImage, &visImg);
               cv::rectangle(visImg, cv::Point(currBB->roi.x, currBB->roi.y),
                             cv::Point(currBB->roi.x + currBB->roi.width,
                                       currBB->roi.y + currBB->roi.height),
@@ -1,19 +1,113 @@
 
 #include "../include/lidarData.hpp"
 #include <algorithm>
+#include <cstdint>
 #include <iostream>
+#include <random>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+#include <opencv2/core/utility.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
 using namespace std;
 
+static_assert(sizeof(LidarPoint) == 4 * sizeof(float), "LidarPoint must match the KITTI Velodyne record layout");
+
+// Voxel-grid downsampling: every point is hashed to its cubic voxel of edge length leafSize and all points of one voxel
+// are replaced by a single representative. Both representatives keep the minimum x of the voxel, so the closest point
+// of an object used by the Lidar TTC is unchanged. The output keeps the order in which the voxels were first hit.
+void downsampleLidarPoints(std::vector<LidarPoint> &lidarPoints, float leafSize, VoxelRepresentative representative)
+{
+    if (leafSize <= 0.0f || lidarPoints.empty())
+    {
+        return;
+    }
+
+    struct Voxel
+    {
+        LidarPoint rep; // current representative (MIN_X) or minimum x and coordinate sums (CENTROID)
+        int count;
+    };
+    std::vector<Voxel> voxels;
+    std::unordered_map<uint64_t, int> voxelIndex; // packed voxel coordinates -> position in voxels
+    voxelIndex.reserve(lidarPoints.size());
+
+    const float invLeaf = 1.0f / leafSize;
+    for (const LidarPoint &pt : lidarPoints)
+    {
+        // 21 bits per axis cover +-1e6 voxels, far beyond the Lidar range for any sensible leaf size
+        const int64_t offset = 1 << 20;
+        uint64_t ix = (uint64_t)((int64_t)floor(pt.x * invLeaf) + offset) & 0x1fffff;
+        uint64_t iy = (uint64_t)((int64_t)floor(pt.y * invLeaf) + offset) & 0x1fffff;
+        uint64_t iz = (uint64_t)((int64_t)floor(pt.z * invLeaf) + offset) & 0x1fffff;
+        uint64_t key = (ix << 42) | (iy << 21) | iz;
+
+        auto inserted = voxelIndex.emplace(key, (int)voxels.size());
+        if (inserted.second)
+        {
+            voxels.push_back({pt, 1});
+            continue;
+        }
+
+        Voxel &voxel = voxels[inserted.first->second];
+        if (representative == VoxelRepresentative::MIN_X)
+        {
+            if (pt.x < voxel.rep.x)
+            {
+                voxel.rep = pt;
+            }
+        }
+        else
+        {
+            voxel.rep.x = min(voxel.rep.x, pt.x);
+            voxel.rep.y += pt.y;
+            voxel.rep.z += pt.z;
+            voxel.rep.r += pt.r;
+        }
+        voxel.count++;
+    }
+
+    lidarPoints.clear();
+    for (Voxel &voxel : voxels)
+    {
+        if (representative == VoxelRepresentative::CENTROID)
+        {
+            voxel.rep.y /= voxel.count;
+            voxel.rep.z /= voxel.count;
+            voxel.rep.r /= voxel.count;
+        }
+        lidarPoints.push_back(voxel.rep);
+    }
+}
+
+// appends the points of a raw {x,y,z,r} float stream which pass the crop, the most selective test (x) comes first
+static void appendCroppedPoints(const float *data, size_t numPoints, vector<LidarPoint> &lidarPoints, float minX, float maxX, float maxY, float minZ, float maxZ, float minR)
+{
+    maxZ = min(maxZ, 0.0f); // points above the sensor are always removed
+    for (size_t i = 0; i < numPoints; ++i, data += 4)
+    {
+        if (data[0] >= minX && data[0] <= maxX && abs(data[1]) <= maxY && data[2] >= minZ && data[2] <= maxZ && data[3] >= minR)
+        {
+            lidarPoints.push_back({data[0], data[1], data[2], data[3]});
+        }
+    }
+}
+
 // remove Lidar points based on min. and max distance in X, Y and Z
 void cropLidarPoints(std::vector<LidarPoint> &lidarPoints, float minX, float maxX, float maxY, float minZ, float maxZ, float minR)
 {
+    maxZ = min(maxZ, 0.0f); // points above the sensor are always removed
     std::vector<LidarPoint> newLidarPts; 
     for(auto it=lidarPoints.begin(); it!=lidarPoints.end(); ++it) {
         
-       if( (*it).x>=minX && (*it).x<=maxX && (*it).z>=minZ && (*it).z<=maxZ && (*it).z<=0.0 && abs((*it).y)<=maxY && (*it).r>=minR )  // Check if Lidar point is outside of boundaries
+       if( (*it).x>=minX && (*it).x<=maxX && (*it).z>=minZ && (*it).z<=maxZ && abs((*it).y)<=maxY && (*it).r>=minR )  // Check if Lidar point is outside of boundaries
        {
            newLidarPts.push_back(*it);
        }
@@ -22,33 +116,254 @@ void cropLidarPoints(std::vector<LidarPoint> &lidarPoints, float minX, float max
     lidarPoints = newLidarPts;
 }
 
+// Crop for the structure-of-arrays cloud: the boundary tests run on 16 (AVX-512) or 8 (AVX2) points at once and produce
+// a bit mask of the survivors, only the set bits are then copied into the cropped cloud
+void cropLidarCloud(const LidarCloud &cloud, LidarCloud &croppedCloud, float minX, float maxX, float maxY, float minZ, float maxZ, float minR)
+{
+    maxZ = min(maxZ, 0.0f); // points above the sensor are always removed
+    croppedCloud.clear();
+
+    const float *px = cloud.x.data(), *py = cloud.y.data(), *pz = cloud.z.data(), *pr = cloud.r.data();
+    const size_t n = cloud.size();
+    auto appendMasked = [&](size_t first, uint32_t mask) {
+        while (mask != 0)
+        {
+            size_t i = first + __builtin_ctz(mask);
+            croppedCloud.push_back({px[i], py[i], pz[i], pr[i]});
+            mask &= mask - 1;
+        }
+    };
+
+    size_t i = 0;
+#if defined(__AVX512F__)
+    const __m512 vMinX = _mm512_set1_ps(minX), vMaxX = _mm512_set1_ps(maxX), vMaxY = _mm512_set1_ps(maxY);
+    const __m512 vMinZ = _mm512_set1_ps(minZ), vMaxZ = _mm512_set1_ps(maxZ), vMinR = _mm512_set1_ps(minR);
+    for (; i + 16 <= n; i += 16)
+    {
+        __m512 x = _mm512_load_ps(px + i), y = _mm512_load_ps(py + i);
+        __m512 z = _mm512_load_ps(pz + i), r = _mm512_load_ps(pr + i);
+        __mmask16 mask = _mm512_cmp_ps_mask(x, vMinX, _CMP_GE_OQ);
+        mask = _mm512_mask_cmp_ps_mask(mask, x, vMaxX, _CMP_LE_OQ);
+        mask = _mm512_mask_cmp_ps_mask(mask, _mm512_abs_ps(y), vMaxY, _CMP_LE_OQ);
+        mask = _mm512_mask_cmp_ps_mask(mask, z, vMinZ, _CMP_GE_OQ);
+        mask = _mm512_mask_cmp_ps_mask(mask, z, vMaxZ, _CMP_LE_OQ);
+        mask = _mm512_mask_cmp_ps_mask(mask, r, vMinR, _CMP_GE_OQ);
+        appendMasked(i, mask);
+    }
+#elif defined(__AVX2__)
+    const __m256 vMinX = _mm256_set1_ps(minX), vMaxX = _mm256_set1_ps(maxX), vMaxY = _mm256_set1_ps(maxY);
+    const __m256 vMinZ = _mm256_set1_ps(minZ), vMaxZ = _mm256_set1_ps(maxZ), vMinR = _mm256_set1_ps(minR);
+    const __m256 vAbsMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 x = _mm256_load_ps(px + i), y = _mm256_load_ps(py + i);
+        __m256 z = _mm256_load_ps(pz + i), r = _mm256_load_ps(pr + i);
+        __m256 mask = _mm256_and_ps(_mm256_cmp_ps(x, vMinX, _CMP_GE_OQ), _mm256_cmp_ps(x, vMaxX, _CMP_LE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_and_ps(y, vAbsMask), vMaxY, _CMP_LE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(z, vMinZ, _CMP_GE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(z, vMaxZ, _CMP_LE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(r, vMinR, _CMP_GE_OQ));
+        appendMasked(i, (uint32_t)_mm256_movemask_ps(mask));
+    }
+#endif
+    for (; i < n; ++i) // remaining points
+    {
+        if (px[i] >= minX && px[i] <= maxX && abs(py[i]) <= maxY && pz[i] >= minZ && pz[i] <= maxZ && pr[i] >= minR)
+        {
+            croppedCloud.push_back({px[i], py[i], pz[i], pr[i]});
+        }
+    }
+}
+
+GroundPlaneSegmenter::GroundPlaneSegmenter(float distanceThreshold, int maxIterations, int warmIterations, float maxTiltDeg)
+    : plane({0.0f, 0.0f, 1.0f, 0.0f}), bHasPlane(false), distanceThreshold(distanceThreshold), maxIterations(maxIterations),
+      warmIterations(warmIterations), minNormalZ((float)cos(maxTiltDeg * CV_PI / 180.0)), frameCount(0)
+{
+}
+
+// number of points within distanceThreshold of the plane, the distances of 8 points are computed at once with AVX2
+int GroundPlaneSegmenter::countInliers(const LidarCloud &cloud, const Plane &hypothesis) const
+{
+    const float *px = cloud.x.data(), *py = cloud.y.data(), *pz = cloud.z.data();
+    const size_t n = cloud.size();
+    int inliers = 0;
+    size_t i = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+    const __m256 a = _mm256_set1_ps(hypothesis.a), b = _mm256_set1_ps(hypothesis.b);
+    const __m256 c = _mm256_set1_ps(hypothesis.c), d = _mm256_set1_ps(hypothesis.d);
+    const __m256 threshold = _mm256_set1_ps(distanceThreshold);
+    const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 dist = _mm256_fmadd_ps(a, _mm256_load_ps(px + i), d);
+        dist = _mm256_fmadd_ps(b, _mm256_load_ps(py + i), dist);
+        dist = _mm256_fmadd_ps(c, _mm256_load_ps(pz + i), dist);
+        __m256 inside = _mm256_cmp_ps(_mm256_and_ps(dist, absMask), threshold, _CMP_LE_OQ);
+        inliers += __builtin_popcount(_mm256_movemask_ps(inside));
+    }
+#endif
+    for (; i < n; ++i)
+    {
+        float dist = hypothesis.a * px[i] + hypothesis.b * py[i] + hypothesis.c * pz[i] + hypothesis.d;
+        inliers += abs(dist) <= distanceThreshold;
+    }
+    return inliers;
+}
 
+bool GroundPlaneSegmenter::fitPlane(const LidarCloud &cloud)
+{
+    const size_t n = cloud.size();
+    if (n < 3)
+    {
+        return false;
+    }
+
+    // draw all hypotheses up front; the previous plane competes as the first one
+    std::vector<Plane> hypotheses;
+    if (bHasPlane)
+    {
+        hypotheses.push_back(plane);
+    }
+    int iterations = bHasPlane ? warmIterations : maxIterations;
+    std::mt19937 rng(++frameCount);
+    std::uniform_int_distribution<size_t> pick(0, n - 1);
+    for (int it = 0; it < iterations; ++it)
+    {
+        LidarPoint p1 = cloud[pick(rng)], p2 = cloud[pick(rng)], p3 = cloud[pick(rng)];
+        float ux = p2.x - p1.x, uy = p2.y - p1.y, uz = p2.z - p1.z;
+        float vx = p3.x - p1.x, vy = p3.y - p1.y, vz = p3.z - p1.z;
+        float a = uy * vz - uz * vy, b = uz * vx - ux * vz, c = ux * vy - uy * vx;
+        float norm = sqrt(a * a + b * b + c * c);
+        if (norm < 1e-6f)
+        {
+            continue; // degenerate sample
+        }
+        float sign = c < 0.0f ? -1.0f : 1.0f; // let the normal point upwards
+        a *= sign / norm; b *= sign / norm; c *= sign / norm;
+        if (c < minNormalZ)
+        {
+            continue; // too steep to be the road
+        }
+        hypotheses.push_back({a, b, c, -(a * p1.x + b * p1.y + c * p1.z)});
+    }
+    if (hypotheses.empty())
+    {
+        return false;
+    }
+
+    // score the hypotheses in parallel, each one scans the whole cloud
+    std::vector<int> inliers(hypotheses.size());
+    cv::parallel_for_(cv::Range(0, (int)hypotheses.size()), [&](const cv::Range &range) {
+        for (int h = range.start; h < range.end; ++h)
+        {
+            inliers[h] = countInliers(cloud, hypotheses[h]);
+        }
+    });
+
+    // the first best hypothesis wins, which keeps the result deterministic
+    size_t best = max_element(inliers.begin(), inliers.end()) - inliers.begin();
+    plane = hypotheses[best];
+    bHasPlane = true;
+    return true;
+}
+
+void GroundPlaneSegmenter::removeGround(const LidarCloud &cloud, std::vector<LidarPoint> &lidarPoints, float minHeight, float maxHeight) const
+{
+    for (size_t i = 0; i < cloud.size(); ++i)
+    {
+        float height = plane.a * cloud.x[i] + plane.b * cloud.y[i] + plane.c * cloud.z[i] + plane.d;
+        if (height >= minHeight && height <= maxHeight)
+        {
+            lidarPoints.push_back(cloud[i]);
+        }
+    }
+}
+
+// same as cropLidarPoints() but reads the points in place from a mapped file, so that only the points inside the boundaries are copied
+void cropLidarPoints(const LidarFileView &lidarFile, std::vector<LidarPoint> &croppedPoints, float minX, float maxX, float maxY, float minZ, float maxZ, float minR)
+{
+    croppedPoints.clear();
+    if (lidarFile.size() > 0)
+    {
+        appendCroppedPoints(&lidarFile[0].x, lidarFile.size(), croppedPoints, minX, maxX, maxY, minZ, maxZ, minR);
+    }
+}
+
+// maps a KITTI Velodyne .bin file into memory, the view stays empty if the file cannot be opened or mapped
+LidarFileView::LidarFileView(const std::string &filename)
+    : mapping(nullptr), mappedBytes(0), points(nullptr), numPoints(0)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        cerr << "Cannot open Lidar file " << filename << endl;
+        return;
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) == 0 && fileStat.st_size >= (off_t)sizeof(LidarPoint))
+    {
+        void *data = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED)
+        {
+            madvise(data, fileStat.st_size, MADV_SEQUENTIAL);
+            mapping = data;
+            mappedBytes = fileStat.st_size;
+            points = static_cast<const LidarPoint *>(data); // mmap returns page aligned memory
+            numPoints = mappedBytes / sizeof(LidarPoint);
+        }
+        else
+        {
+            cerr << "Cannot map Lidar file " << filename << endl;
+        }
+    }
+    close(fd); // the mapping stays valid after closing the descriptor
+}
+
+LidarFileView::~LidarFileView()
+{
+    if (mapping != nullptr)
+    {
+        munmap(mapping, mappedBytes);
+    }
+}
 
 // Load Lidar points from a given location and store them in a vector
 void loadLidarFromFile(vector<LidarPoint> &lidarPoints, string filename)
 {
-    // allocate 4 MB buffer (only ~130*4*4 KB are needed)
-    unsigned long num = 1000000;
-    float *data = (float*)malloc(num*sizeof(float));
-    
-    // pointers
-    float *px = data+0;
-    float *py = data+1;
-    float *pz = data+2;
-    float *pr = data+3;
-    
-    // load point cloud
-    FILE *stream;
-    stream = fopen (filename.c_str(),"rb");
-    num = fread(data,sizeof(float),num,stream)/4;
- 
-    for (int32_t i=0; i<num; i++) {
-        LidarPoint lpt;
-        lpt.x = *px; lpt.y = *py; lpt.z = *pz; lpt.r = *pr;
-        lidarPoints.push_back(lpt);
-        px+=4; py+=4; pz+=4; pr+=4;
+    LidarFileView lidarFile(filename);
+    lidarPoints.insert(lidarPoints.end(), lidarFile.begin(), lidarFile.end());
+}
+
+// Loads a KITTI Velodyne file and applies the crop of cropLidarPoints() while parsing it, so that only the surviving
+// points are ever written into lidarPoints (e.g. straight into a DataFrame). The file is read through a memory mapping
+// and falls back to a chunked fread() for files which cannot be mapped. Returns false if the file cannot be read.
+bool loadCroppedLidarFromFile(std::vector<LidarPoint> &lidarPoints, std::string filename, float minX, float maxX, float maxY, float minZ, float maxZ, float minR)
+{
+    lidarPoints.clear();
+    {
+        LidarFileView lidarFile(filename);
+        if (lidarFile.isOpen())
+        {
+            cropLidarPoints(lidarFile, lidarPoints, minX, maxX, maxY, minZ, maxZ, minR);
+            return true;
+        }
+    }
+
+    FILE *stream = fopen(filename.c_str(), "rb");
+    if (stream == nullptr)
+    {
+        return false;
+    }
+    const size_t chunkPoints = 4096;
+    vector<float> chunk(4 * chunkPoints);
+    size_t num;
+    while ((num = fread(chunk.data(), 4 * sizeof(float), chunkPoints, stream)) > 0)
+    {
+        appendCroppedPoints(chunk.data(), num, lidarPoints, minX, maxX, maxY, minZ, maxZ, minR);
     }
     fclose(stream);
+    return true;
 }
 
 
@@ -88,7 +403,79 @@ void showLidarTopview(std::vector<LidarPoint> &lidarPoints, cv::Size worldSize,
     }
 }
 
-void showLidarImgOverlay(cv::Mat &img, std::vector<LidarPoint> &lidarPoints, cv::Mat &P_rect_xx, cv::Mat &R_rect_xx, cv::Mat &RT, cv::Mat *extVisImg)
+cv::Matx34f computeLidarProjection(const cv::Mat &P_rect_xx, const cv::Mat &R_rect_xx, const cv::Mat &RT)
+{
+    cv::Mat projection = P_rect_xx * R_rect_xx * RT; // multiply in double precision, store in float
+    cv::Matx34f lidarToImage;
+    for (int row = 0; row < 3; ++row)
+    {
+        for (int col = 0; col < 4; ++col)
+        {
+            lidarToImage(row, col) = (float)projection.at<double>(row, col);
+        }
+    }
+    return lidarToImage;
+}
+
+// Batched projection of an array of LidarPoints. With AVX2, the coordinates of 8 points are gathered into registers and
+// projected at once, otherwise the loop is left to the compiler's vectorizer.
+void projectLidarPoints(const cv::Matx34f &lidarToImage, const LidarPoint *points, size_t numPoints, cv::Point2f *pixels, float *depths)
+{
+    const cv::Matx34f &P = lidarToImage;
+    size_t i = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+    const __m256 p00 = _mm256_set1_ps(P(0, 0)), p01 = _mm256_set1_ps(P(0, 1)), p02 = _mm256_set1_ps(P(0, 2)), p03 = _mm256_set1_ps(P(0, 3));
+    const __m256 p10 = _mm256_set1_ps(P(1, 0)), p11 = _mm256_set1_ps(P(1, 1)), p12 = _mm256_set1_ps(P(1, 2)), p13 = _mm256_set1_ps(P(1, 3));
+    const __m256 p20 = _mm256_set1_ps(P(2, 0)), p21 = _mm256_set1_ps(P(2, 1)), p22 = _mm256_set1_ps(P(2, 2)), p23 = _mm256_set1_ps(P(2, 3));
+    const __m256i stride = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+    for (; i + 8 <= numPoints; i += 8)
+    {
+        const float *base = &points[i].x;
+        __m256 x = _mm256_i32gather_ps(base, stride, 4);
+        __m256 y = _mm256_i32gather_ps(base + 1, stride, 4);
+        __m256 z = _mm256_i32gather_ps(base + 2, stride, 4);
+        __m256 u = _mm256_fmadd_ps(p00, x, _mm256_fmadd_ps(p01, y, _mm256_fmadd_ps(p02, z, p03)));
+        __m256 v = _mm256_fmadd_ps(p10, x, _mm256_fmadd_ps(p11, y, _mm256_fmadd_ps(p12, z, p13)));
+        __m256 w = _mm256_fmadd_ps(p20, x, _mm256_fmadd_ps(p21, y, _mm256_fmadd_ps(p22, z, p23)));
+        __m256 invW = _mm256_div_ps(_mm256_set1_ps(1.0f), w);
+        u = _mm256_mul_ps(u, invW);
+        v = _mm256_mul_ps(v, invW);
+
+        // interleave u and v into Point2f pairs
+        __m256 lo = _mm256_unpacklo_ps(u, v); // u0 v0 u1 v1 | u4 v4 u5 v5
+        __m256 hi = _mm256_unpackhi_ps(u, v); // u2 v2 u3 v3 | u6 v6 u7 v7
+        float *out = &pixels[i].x;
+        _mm256_storeu_ps(out, _mm256_permute2f128_ps(lo, hi, 0x20));
+        _mm256_storeu_ps(out + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+        _mm256_storeu_ps(depths + i, w);
+    }
+#endif
+    for (; i < numPoints; ++i)
+    {
+        const LidarPoint &pt = points[i];
+        float u = P(0, 0) * pt.x + P(0, 1) * pt.y + P(0, 2) * pt.z + P(0, 3);
+        float v = P(1, 0) * pt.x + P(1, 1) * pt.y + P(1, 2) * pt.z + P(1, 3);
+        float w = P(2, 0) * pt.x + P(2, 1) * pt.y + P(2, 2) * pt.z + P(2, 3);
+        pixels[i] = cv::Point2f(u / w, v / w);
+        depths[i] = w;
+    }
+}
+
+const ProjectedLidarPoints &getProjectedLidarPoints(DataFrame &frame, const cv::Matx34f &lidarToImage)
+{
+    ProjectedLidarPoints &projection = frame.lidarProjection;
+    if (!projection.valid || projection.pixels.size() != frame.lidarPoints.size())
+    {
+        projection.pixels.resize(frame.lidarPoints.size());
+        projection.depths.resize(frame.lidarPoints.size());
+        projectLidarPoints(lidarToImage, frame.lidarPoints.data(), frame.lidarPoints.size(), projection.pixels.data(), projection.depths.data());
+        projection.valid = true;
+    }
+    return projection;
+}
+
+// draws already projected Lidar points color coded by their distance
+static void drawLidarImgOverlay(cv::Mat &img, const std::vector<LidarPoint> &lidarPoints, const std::vector<cv::Point2f> &pixels, cv::Mat *extVisImg)
 {
     // init image for visualization
     cv::Mat visImg; 
@@ -109,25 +496,15 @@ void showLidarImgOverlay(cv::Mat &img, std::vector<LidarPoint> &lidarPoints, cv:
         maxVal = maxVal<it->x ? it->x : maxVal;
     }
 
-    cv::Mat X(4,1,cv::DataType<double>::type);
-    cv::Mat Y(3,1,cv::DataType<double>::type);
-    for(auto it=lidarPoints.begin(); it!=lidarPoints.end(); ++it) {
-
-            X.at<double>(0, 0) = it->x;
-            X.at<double>(1, 0) = it->y;
-            X.at<double>(2, 0) = it->z;
-            X.at<double>(3, 0) = 1;
+    for(size_t i=0; i<lidarPoints.size(); ++i) {
 
-            Y = P_rect_xx * R_rect_xx * RT * X;
-            cv::Point pt;
-            // pixel coordinates
-            pt.x = Y.at<double>(0, 0) / Y.at<double>(2, 0); 
-            pt.y = Y.at<double>(1, 0) / Y.at<double>(2, 0); 
+        // pixel coordinates
+        cv::Point pt((int)pixels[i].x, (int)pixels[i].y);
 
-            float val = it->x;
-            int red = min(255, (int)(255 * abs((val - maxVal) / maxVal)));
-            int green = min(255, (int)(255 * (1 - abs((val - maxVal) / maxVal))));
-            cv::circle(overlay, pt, 5, cv::Scalar(0, green, red), -1);
+        float val = lidarPoints[i].x;
+        int red = min(255, (int)(255 * abs((val - maxVal) / maxVal)));
+        int green = min(255, (int)(255 * (1 - abs((val - maxVal) / maxVal))));
+        cv::circle(overlay, pt, 5, cv::Scalar(0, green, red), -1);
     }
 
     float opacity = 0.6;
@@ -145,4 +522,38 @@ void showLidarImgOverlay(cv::Mat &img, std::vector<LidarPoint> &lidarPoints, cv:
     {
         extVisImg = &visImg;
     }
-}
\ No newline at end of file
+}
+
+void showLidarImgOverlay(cv::Mat &img, std::vector<LidarPoint> &lidarPoints, cv::Mat &P_rect_xx, cv::Mat &R_rect_xx, cv::Mat &RT, cv::Mat *extVisImg)
+{
+    showLidarImgOverlay(img, lidarPoints, computeLidarProjection(P_rect_xx, R_rect_xx, RT), extVisImg);
+}
+
+void showLidarImgOverlay(cv::Mat &img, std::vector<LidarPoint> &lidarPoints, const cv::Matx34f &lidarToImage, cv::Mat *extVisImg)
+{
+    std::vector<cv::Point2f> pixels(lidarPoints.size());
+    std::vector<float> depths(lidarPoints.size());
+    projectLidarPoints(lidarToImage, lidarPoints.data(), lidarPoints.size(), pixels.data(), depths.data());
+    drawLidarImgOverlay(img, lidarPoints, pixels, extVisImg);
+}
+
+// overlay of the Lidar points of one box, their pixel positions are looked up in the projection cache of the frame
+void showLidarImgOverlay(cv::Mat &img, DataFrame &frame, const BoundingBox &boundingBox, const cv::Matx34f &lidarToImage, cv::Mat *extVisImg)
+{
+    if (boundingBox.lidarPointIndices.size() != boundingBox.lidarPoints.size())
+    {
+        // the box points were not associated through the frame, project them directly
+        std::vector<LidarPoint> lidarPoints = boundingBox.lidarPoints;
+        showLidarImgOverlay(img, lidarPoints, lidarToImage, extVisImg);
+        return;
+    }
+
+    const ProjectedLidarPoints &projection = getProjectedLidarPoints(frame, lidarToImage);
+    std::vector<cv::Point2f> pixels;
+    pixels.reserve(boundingBox.lidarPointIndices.size());
+    for (int idx : boundingBox.lidarPointIndices)
+    {
+        pixels.push_back(projection.pixels[idx]);
+    }
+    drawLidarImgOverlay(img, boundingBox.lidarPoints, pixels, extVisImg);
+}
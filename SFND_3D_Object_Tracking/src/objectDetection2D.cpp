@@ -1,7 +1,13 @@
-
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <algorithm>
+#include <map>
+#include <memory>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 #include <opencv2/dnn.hpp>
 #include <opencv2/imgproc.hpp>
@@ -11,78 +17,371 @@
 
 using namespace std;
 
-// detects objects in an image using the YOLO library and a set of pre-trained objects from the COCO database;
-// a set of 80 classes is listed in "coco.names" and pre-trained weights are stored in "yolov3.weights"
-void detectObjects(cv::Mat& img, std::vector<BoundingBox>& bBoxes, float confThreshold, float nmsThreshold, 
-                   std::string basePath, std::string classesFile, std::string modelConfiguration, std::string modelWeights, bool bVis)
+// returns the index of the largest of n class scores and stores its value in maxScore; ties resolve to the lowest
+// index like cv::minMaxLoc() does
+static int argmaxScores(const float* scores, int n, float& maxScore)
+{
+    int best = 0;
+    float bestVal = scores[0];
+    int i = 1;
+#ifdef __AVX2__
+    if (n >= 8)
+    {
+        // keep a running maximum and its index in each of the 8 lanes
+        __m256 vMax = _mm256_loadu_ps(scores);
+        __m256i vIdx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        __m256i vCurr = vIdx;
+        const __m256i vStep = _mm256_set1_epi32(8);
+        for (i = 8; i + 8 <= n; i += 8)
+        {
+            vCurr = _mm256_add_epi32(vCurr, vStep);
+            __m256 v = _mm256_loadu_ps(scores + i);
+            __m256 gt = _mm256_cmp_ps(v, vMax, _CMP_GT_OQ);
+            vMax = _mm256_blendv_ps(vMax, v, gt);
+            vIdx = _mm256_blendv_epi8(vIdx, vCurr, _mm256_castps_si256(gt));
+        }
+
+        // reduce the lanes, the remaining n % 8 scores are handled by the scalar loop below
+        alignas(32) float laneMax[8];
+        alignas(32) int laneIdx[8];
+        _mm256_store_ps(laneMax, vMax);
+        _mm256_store_si256((__m256i*)laneIdx, vIdx);
+        bestVal = laneMax[0];
+        best = laneIdx[0];
+        for (int k = 1; k < 8; ++k)
+        {
+            if (laneMax[k] > bestVal || (laneMax[k] == bestVal && laneIdx[k] < best))
+            {
+                bestVal = laneMax[k];
+                best = laneIdx[k];
+            }
+        }
+    }
+#endif
+    for (; i < n; ++i)
+    {
+        if (scores[i] > bestVal)
+        {
+            bestVal = scores[i];
+            best = i;
+        }
+    }
+    maxScore = bestVal;
+    return best;
+}
+
+// loads everything which does not change between frames: class names, network weights and output layer names
+ObjectDetector::ObjectDetector(std::string classesFile, std::string modelConfiguration, std::string modelWeights,
+                               float confThreshold, float nmsThreshold, cv::Size inputSize)
+    : classAwareNms(false), inputSize(inputSize), confThreshold(confThreshold), nmsThreshold(nmsThreshold)
 {
     // load class names from file
-    vector<string> classes;
     ifstream ifs(classesFile.c_str());
     string line;
     while (getline(ifs, line)) classes.push_back(line);
     
     // load neural network
-    cv::dnn::Net net = cv::dnn::readNetFromDarknet(modelConfiguration, modelWeights);
+    net = cv::dnn::readNetFromDarknet(modelConfiguration, modelWeights);
     net.setPreferableBackend(cv::dnn::DNN_BACKEND_OPENCV);
     net.setPreferableTarget(cv::dnn::DNN_TARGET_CPU);
     
-    // generate 4D blob from input image
-    cv::Mat blob;
-    vector<cv::Mat> netOutput;
-    double scalefactor = 1/255.0;
-    cv::Size size = cv::Size(416, 416);
-    cv::Scalar mean = cv::Scalar(0,0,0);
-    bool swapRB = false;
-    bool crop = false;
-    cv::dnn::blobFromImage(img, blob, scalefactor, size, mean, swapRB, crop);
-    
     // Get names of output layers
-    vector<cv::String> names;
     vector<int> outLayers = net.getUnconnectedOutLayers(); // get  indices of  output layers, i.e.  layers with unconnected outputs
     vector<cv::String> layersNames = net.getLayerNames(); // get  names of all layers in the network
     
-    names.resize(outLayers.size());
+    outNames.resize(outLayers.size());
     for (size_t i = 0; i < outLayers.size(); ++i) // Get the names of the output layers in names
-        names[i] = layersNames[outLayers[i] - 1];
+        outNames[i] = layersNames[outLayers[i] - 1];
+
+    // candidate buffers are reused by every frame, so reserve enough room for a busy scene up front
+    classIds.reserve(1024);
+    confidences.reserve(1024);
+    boxes.reserve(1024);
+    indices.reserve(256);
+
+    // allocate the NCHW input blob once, preprocess() refills it in place for every frame
+    int blobSize[] = {1, 3, inputSize.height, inputSize.width};
+    blob.create(4, blobSize, CV_32F);
+}
+
+void ObjectDetector::setThresholds(float confThreshold, float nmsThreshold)
+{
+    this->confThreshold = confThreshold;
+    this->nmsThreshold = nmsThreshold;
+}
+
+void ObjectDetector::setClassFilter(const std::vector<int>& allowedClassIds)
+{
+    classAllowed.clear();
+    if (allowedClassIds.empty())
+    {
+        return;
+    }
+    classAllowed.assign(max(classes.size(), (size_t)1), false);
+    for (int classId : allowedClassIds)
+    {
+        if (classId >= (int)classAllowed.size())
+        {
+            classAllowed.resize(classId + 1, false);
+        }
+        classAllowed[classId] = true;
+    }
+}
+
+// changes the network input resolution, the Darknet models accept any multiple of 32
+void ObjectDetector::setInputSize(cv::Size inputSize)
+{
+    if (inputSize == this->inputSize)
+    {
+        return;
+    }
+    this->inputSize = inputSize;
+    int blobSize[] = {1, 3, inputSize.height, inputSize.width};
+    blob.create(4, blobSize, CV_32F);
+}
+
+// detects objects in an image using the YOLO library and a set of pre-trained objects from the COCO database;
+// a set of 80 classes is listed in "coco.names" and pre-trained weights are stored in "yolov3.weights"
+void ObjectDetector::detect(cv::Mat& img, std::vector<BoundingBox>& bBoxes, bool bVis)
+{
+    // generate 4D blob from input image
+    if (!preprocess(img, blob.ptr<float>()))
+    {
+        double scalefactor = 1/255.0;
+        cv::Scalar mean = cv::Scalar(0,0,0);
+        bool swapRB = false;
+        bool crop = false;
+        cv::dnn::blobFromImage(img, blob, scalefactor, inputSize, mean, swapRB, crop);
+    }
     
     // invoke forward propagation through network
     net.setInput(blob);
-    net.forward(netOutput, names);
+    net.forward(netOutput, outNames);
     
+    decodeOutput(0, 1, img.size(), bBoxes);
+    
+    // show results
+    if(bVis) {
+        showDetections(img, bBoxes);
+    }
+}
+
+// same as detect() but for a whole batch of images, which lets the network amortize weight loads across frames
+void ObjectDetector::detectBatch(const std::vector<cv::Mat>& imgs, std::vector<std::vector<BoundingBox>>& bBoxes)
+{
+    bBoxes.resize(imgs.size());
+    if (imgs.empty())
+    {
+        return;
+    }
+
+    // generate one NCHW blob from all input images, each image is written straight into its slice of the blob
+    int blobSize[] = {(int)imgs.size(), 3, inputSize.height, inputSize.width};
+    batchBlob.create(4, blobSize, CV_32F);
+    size_t imgStride = (size_t)3 * inputSize.area();
+    bool bPreprocessed = true;
+    for (size_t i = 0; i < imgs.size() && bPreprocessed; ++i)
+    {
+        bPreprocessed = preprocess(imgs[i], batchBlob.ptr<float>() + i * imgStride);
+    }
+    if (!bPreprocessed)
+    {
+        double scalefactor = 1/255.0;
+        cv::Scalar mean = cv::Scalar(0,0,0);
+        bool swapRB = false;
+        bool crop = false;
+        cv::dnn::blobFromImages(imgs, batchBlob, scalefactor, inputSize, mean, swapRB, crop);
+    }
+
+    // invoke forward propagation through network
+    net.setInput(batchBlob);
+    net.forward(netOutput, outNames);
+
+    // split the decoded detections back into the individual images
+    for (size_t i = 0; i < imgs.size(); ++i)
+    {
+        decodeOutput((int)i, (int)imgs.size(), imgs[i].size(), bBoxes[i]);
+    }
+}
+
+// Writes the network input for one 8-bit BGR image straight into the planar float tensor at dst. Resizing, conversion
+// to float, scaling by 1/255 and the HWC -> CHW transpose are fused into one pass without temporary images, which gives
+// the same result as cv::dnn::blobFromImage(img, blob, 1/255.0, inputSize) up to rounding. The bilinear tables follow
+// the pixel-center convention of cv::resize(INTER_LINEAR) and are only recomputed when the image size changes. Returns
+// false for images of any other type so that the caller can fall back to blobFromImage().
+bool ObjectDetector::preprocess(const cv::Mat& img, float* dst)
+{
+    if (img.empty() || img.type() != CV_8UC3)
+    {
+        return false;
+    }
+
+    const int dstW = inputSize.width, dstH = inputSize.height;
+    const int srcW = img.cols, srcH = img.rows;
+    if (prepSrcSize != img.size() || (int)prepX0.size() != dstW || (int)prepY0.size() != dstH)
+    {
+        auto computeTable = [](int srcLen, int dstLen, vector<int>& idx0, vector<int>& idx1, vector<float>& w) {
+            idx0.resize(dstLen); idx1.resize(dstLen); w.resize(dstLen);
+            double scale = (double)srcLen / dstLen;
+            for (int d = 0; d < dstLen; ++d)
+            {
+                double f = (d + 0.5) * scale - 0.5;
+                int s0 = (int)floor(f);
+                f -= s0;
+                if (s0 < 0)
+                {
+                    s0 = 0; f = 0;
+                }
+                if (s0 >= srcLen - 1)
+                {
+                    s0 = srcLen - 1; f = 0;
+                }
+                idx0[d] = s0;
+                idx1[d] = min(s0 + 1, srcLen - 1);
+                w[d] = (float)f;
+            }
+        };
+        computeTable(srcW, dstW, prepX0, prepX1, prepWx);
+        computeTable(srcH, dstH, prepY0, prepY1, prepWy);
+        for (int x = 0; x < dstW; ++x) // byte offsets of the first channel within a BGR row
+        {
+            prepX0[x] *= 3;
+            prepX1[x] *= 3;
+        }
+        prepSrcSize = img.size();
+    }
+    prepRows.resize((size_t)6 * dstW);
+
+    // horizontally resizes one source row into three float planes, already scaled by 1/255
+    const float scale = 1.0f / 255.0f;
+    auto resizeRow = [&](int srcRow, float* rowPlanes) {
+        const unsigned char* src = img.ptr<unsigned char>(srcRow);
+        for (int x = 0; x < dstW; ++x)
+        {
+            const unsigned char* p0 = src + prepX0[x];
+            const unsigned char* p1 = src + prepX1[x];
+            float w1 = prepWx[x] * scale, w0 = scale - w1;
+            rowPlanes[x] = p0[0] * w0 + p1[0] * w1;
+            rowPlanes[dstW + x] = p0[1] * w0 + p1[1] * w1;
+            rowPlanes[2 * dstW + x] = p0[2] * w0 + p1[2] * w1;
+        }
+    };
+
+    float* rowA = prepRows.data(); // holds source row rowIdxA
+    float* rowB = rowA + 3 * dstW; // holds source row rowIdxB
+    int rowIdxA = -1, rowIdxB = -1;
+    const size_t planeSize = (size_t)dstW * dstH;
+    for (int y = 0; y < dstH; ++y)
+    {
+        // consecutive output rows mostly share their source rows, so only resize the ones not cached yet
+        int y0 = prepY0[y], y1 = prepY1[y];
+        if (rowIdxA != y0)
+        {
+            if (rowIdxB == y0)
+            {
+                swap(rowA, rowB);
+                swap(rowIdxA, rowIdxB);
+            }
+            else
+            {
+                resizeRow(y0, rowA);
+                rowIdxA = y0;
+            }
+        }
+        if (rowIdxB != y1)
+        {
+            resizeRow(y1, rowB);
+            rowIdxB = y1;
+        }
+
+        // vertical blend of the two rows into the output planes
+        const float wy1 = prepWy[y], wy0 = 1.0f - wy1;
+        for (int c = 0; c < 3; ++c)
+        {
+            const float* a = rowA + c * dstW;
+            const float* b = rowB + c * dstW;
+            float* out = dst + c * planeSize + (size_t)y * dstW;
+            int x = 0;
+#ifdef __AVX2__
+            const __m256 vWy0 = _mm256_set1_ps(wy0), vWy1 = _mm256_set1_ps(wy1);
+            for (; x + 8 <= dstW; x += 8)
+            {
+                __m256 v = _mm256_mul_ps(_mm256_loadu_ps(a + x), vWy0);
+                v = _mm256_add_ps(v, _mm256_mul_ps(_mm256_loadu_ps(b + x), vWy1));
+                _mm256_storeu_ps(out + x, v);
+            }
+#endif
+            for (; x < dstW; ++x)
+            {
+                out[x] = a[x] * wy0 + b[x] * wy1;
+            }
+        }
+    }
+    return true;
+}
+
+// decodes the part of the last network output which belongs to image batchIdx of the batch
+void ObjectDetector::decodeOutput(int batchIdx, int batchSize, cv::Size imgSize, std::vector<BoundingBox>& bBoxes)
+{
     // Scan through all bounding boxes and keep only the ones with high confidence
-    vector<int> classIds; vector<float> confidences; vector<cv::Rect> boxes;
+    classIds.clear(); confidences.clear(); boxes.clear();
     for (size_t i = 0; i < netOutput.size(); ++i)
     {
-        float* data = (float*)netOutput[i].data;
-        for (int j = 0; j < netOutput[i].rows; ++j, data += netOutput[i].cols)
+        // a region layer returns a (boxes, 5 + classes) matrix for a single image and a 3-D (N, boxes, 5 + classes)
+        // blob for a batch, where rows and cols of the cv::Mat are -1
+        int cols, rowsPerImage;
+        if (netOutput[i].dims == 3)
+        {
+            rowsPerImage = netOutput[i].size[1];
+            cols = netOutput[i].size[2];
+        }
+        else
+        {
+            rowsPerImage = netOutput[i].rows / batchSize;
+            cols = netOutput[i].cols;
+        }
+        int nClasses = cols - 5;
+        const float* data = (const float*)netOutput[i].data + (size_t)batchIdx * rowsPerImage * cols;
+        for (int j = 0; j < rowsPerImage; ++j, data += cols)
         {
-            cv::Mat scores = netOutput[i].row(j).colRange(5, netOutput[i].cols);
-            cv::Point classId;
-            double confidence;
-            
+            // the class scores are already weighted by the objectness in data[4], so no class can beat the threshold
+            // if the objectness does not; this rejects most background rows before their scores are touched
+            if (data[4] <= confThreshold)
+            {
+                continue;
+            }
+
             // Get the value and location of the maximum score
-            cv::minMaxLoc(scores, 0, &confidence, 0, &classId);
-            if (confidence > confThreshold)
+            float confidence;
+            int classId = argmaxScores(data + 5, nClasses, confidence);
+            if (confidence > confThreshold &&
+                (classAllowed.empty() || (classId < (int)classAllowed.size() && classAllowed[classId])))
             {
                 cv::Rect box; int cx, cy;
-                cx = (int)(data[0] * img.cols);
-                cy = (int)(data[1] * img.rows);
-                box.width = (int)(data[2] * img.cols);
-                box.height = (int)(data[3] * img.rows);
+                cx = (int)(data[0] * imgSize.width);
+                cy = (int)(data[1] * imgSize.height);
+                box.width = (int)(data[2] * imgSize.width);
+                box.height = (int)(data[3] * imgSize.height);
                 box.x = cx - box.width/2; // left
                 box.y = cy - box.height/2; // top
                 
                 boxes.push_back(box);
-                classIds.push_back(classId.x);
-                confidences.push_back((float)confidence);
+                classIds.push_back(classId);
+                confidences.push_back(confidence);
             }
         }
     }
     
     // perform non-maxima suppression
-    vector<int> indices;
-    cv::dnn::NMSBoxes(boxes, confidences, confThreshold, nmsThreshold, indices);
+    indices.clear();
+    if (classAwareNms)
+    {
+        suppressNonMaximaPerClass();
+    }
+    else
+    {
+        cv::dnn::NMSBoxes(boxes, confidences, confThreshold, nmsThreshold, indices);
+    }
     for(auto it=indices.begin(); it!=indices.end(); ++it) {
         
         BoundingBox bBox;
@@ -90,39 +389,195 @@ void detectObjects(cv::Mat& img, std::vector<BoundingBox>& bBoxes, float confThr
         bBox.classID = classIds[*it];
         bBox.confidence = confidences[*it];
         bBox.boxID = (int)bBoxes.size(); // zero-based unique identifier for this bounding box
+        bBox.trackID = -1; // not assigned to a track yet
         
         bBoxes.push_back(bBox);
     }
-    
-    // show results
-    if(bVis) {
+}
+
+// greedy non-maxima suppression within each class: the candidates are sorted once by class and descending confidence
+// and copied into structure-of-arrays corner buffers, so that the IoU of a kept box against all remaining boxes of
+// its class is a branch-free loop over contiguous floats which the compiler vectorizes
+void ObjectDetector::suppressNonMaximaPerClass()
+{
+    size_t n = boxes.size();
+    nmsOrder.resize(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        nmsOrder[i] = (int)i;
+    }
+    sort(nmsOrder.begin(), nmsOrder.end(), [this](int a, int b) {
+        return classIds[a] != classIds[b] ? classIds[a] < classIds[b] : confidences[a] > confidences[b];
+    });
+
+    nmsX1.resize(n); nmsY1.resize(n); nmsX2.resize(n); nmsY2.resize(n); nmsArea.resize(n);
+    nmsSuppressed.assign(n, 0);
+    for (size_t i = 0; i < n; ++i)
+    {
+        const cv::Rect &box = boxes[nmsOrder[i]];
+        nmsX1[i] = (float)box.x;
+        nmsY1[i] = (float)box.y;
+        nmsX2[i] = (float)(box.x + box.width);
+        nmsY2[i] = (float)(box.y + box.height);
+        nmsArea[i] = (float)box.width * (float)box.height;
+    }
+
+    const float *x1 = nmsX1.data(), *y1 = nmsY1.data(), *x2 = nmsX2.data(), *y2 = nmsY2.data(), *area = nmsArea.data();
+    unsigned char *suppressed = nmsSuppressed.data();
+    size_t groupStart = 0;
+    while (groupStart < n)
+    {
+        // boxes of one class form a contiguous group in the sorted order
+        size_t groupEnd = groupStart + 1;
+        while (groupEnd < n && classIds[nmsOrder[groupEnd]] == classIds[nmsOrder[groupStart]])
+        {
+            ++groupEnd;
+        }
+
+        for (size_t i = groupStart; i < groupEnd; ++i)
+        {
+            if (suppressed[i])
+            {
+                continue;
+            }
+            indices.push_back(nmsOrder[i]);
+
+            const float bx1 = x1[i], by1 = y1[i], bx2 = x2[i], by2 = y2[i], bArea = area[i];
+            for (size_t j = i + 1; j < groupEnd; ++j)
+            {
+                float w = max(0.0f, min(bx2, x2[j]) - max(bx1, x1[j]));
+                float h = max(0.0f, min(by2, y2[j]) - max(by1, y1[j]));
+                float inter = w * h;
+                // IoU > nmsThreshold without the division
+                suppressed[j] |= (unsigned char)(inter > nmsThreshold * (bArea + area[j] - inter));
+            }
+        }
+        groupStart = groupEnd;
+    }
+
+    // report the survivors by descending confidence like cv::dnn::NMSBoxes() does
+    sort(indices.begin(), indices.end(), [this](int a, int b) { return confidences[a] > confidences[b]; });
+}
+
+void ObjectDetector::showDetections(cv::Mat& img, std::vector<BoundingBox>& bBoxes)
+{
+    cv::Mat visImg = img.clone();
+    for(auto it=bBoxes.begin(); it!=bBoxes.end(); ++it) {
         
-        cv::Mat visImg = img.clone();
-        for(auto it=bBoxes.begin(); it!=bBoxes.end(); ++it) {
-            
-            // Draw rectangle displaying the bounding box
-            int top, left, width, height;
-            top = (*it).roi.y;
-            left = (*it).roi.x;
-            width = (*it).roi.width;
-            height = (*it).roi.height;
-            cv::rectangle(visImg, cv::Point(left, top), cv::Point(left+width, top+height),cv::Scalar(0, 255, 0), 2);
-            
-            string label = cv::format("%.2f", (*it).confidence);
-            label = classes[((*it).classID)] + ":" + label;
+        // Draw rectangle displaying the bounding box
+        int top, left, width, height;
+        top = (*it).roi.y;
+        left = (*it).roi.x;
+        width = (*it).roi.width;
+        height = (*it).roi.height;
+        cv::rectangle(visImg, cv::Point(left, top), cv::Point(left+width, top+height),cv::Scalar(0, 255, 0), 2);
         
-            // Display label at the top of the bounding box
-            int baseLine;
-            cv::Size labelSize = getTextSize(label, cv::FONT_ITALIC, 0.5, 1, &baseLine);
-            top = max(top, labelSize.height);
-            rectangle(visImg, cv::Point(left, top - round(1.5*labelSize.height)), cv::Point(left + round(1.5*labelSize.width), top + baseLine), cv::Scalar(255, 255, 255), cv::FILLED);
-            cv::putText(visImg, label, cv::Point(left, top), cv::FONT_ITALIC, 0.75, cv::Scalar(0,0,0),1);
-            
-        }
+        string label = cv::format("%.2f", (*it).confidence);
+        label = classes[((*it).classID)] + ":" + label;
+    
+        // Display label at the top of the bounding box
+        int baseLine;
+        cv::Size labelSize = getTextSize(label, cv::FONT_ITALIC, 0.5, 1, &baseLine);
+        top = max(top, labelSize.height);
+        rectangle(visImg, cv::Point(left, top - round(1.5*labelSize.height)), cv::Point(left + round(1.5*labelSize.width), top + baseLine), cv::Scalar(255, 255, 255), cv::FILLED);
+        cv::putText(visImg, label, cv::Point(left, top), cv::FONT_ITALIC, 0.75, cv::Scalar(0,0,0),1);
         
-        string windowName = "Object classification";
-        cv::namedWindow( windowName, 2 );
-        cv::imshow( windowName, visImg );
-        //cv::waitKey(0); // wait for key to be pressed
     }
-}
\ No newline at end of file
+    
+    string windowName = "Object classification";
+    cv::namedWindow( windowName, 2 );
+    cv::imshow( windowName, visImg );
+    //cv::waitKey(0); // wait for key to be pressed
+}
+
+AdaptiveObjectDetector::AdaptiveObjectDetector(std::string classesFile, std::vector<DetectorLevel> levels,
+                                               float confThreshold, float nmsThreshold, double latencyBudget,
+                                               size_t startLevel)
+    : classesFile(classesFile), levels(levels), confThreshold(confThreshold), nmsThreshold(nmsThreshold),
+      classAwareNms(false), latencyBudget(latencyBudget), currLevel(levels.empty() ? 0 : min(startLevel, levels.size() - 1)),
+      avgLatency(0.0), framesAtLevel(0)
+{
+    if (levels.empty())
+        CV_Error(cv::Error::StsBadArg, "AdaptiveObjectDetector needs at least one detector level");
+    getSession(this->levels[currLevel]);
+}
+
+// networks are only loaded when the controller switches to one of their levels for the first time
+ObjectDetector& AdaptiveObjectDetector::getSession(const DetectorLevel& level)
+{
+    unique_ptr<ObjectDetector> &session = sessions[level.modelConfiguration + "|" + level.modelWeights];
+    if (!session)
+    {
+        session.reset(new ObjectDetector(classesFile, level.modelConfiguration, level.modelWeights,
+                                         confThreshold, nmsThreshold, level.inputSize));
+        session->setClassFilter(allowedClassIds);
+        session->setClassAwareNms(classAwareNms);
+    }
+    return *session;
+}
+
+void AdaptiveObjectDetector::setClassFilter(const std::vector<int>& allowedClassIds)
+{
+    this->allowedClassIds = allowedClassIds;
+    for (auto &session : sessions)
+    {
+        session.second->setClassFilter(allowedClassIds);
+    }
+}
+
+void AdaptiveObjectDetector::setClassAwareNms(bool enable)
+{
+    classAwareNms = enable;
+    for (auto &session : sessions)
+    {
+        session.second->setClassAwareNms(enable);
+    }
+}
+
+void AdaptiveObjectDetector::detect(cv::Mat& img, std::vector<BoundingBox>& bBoxes, bool bVis)
+{
+    const DetectorLevel &level = levels[currLevel];
+    ObjectDetector &session = getSession(level);
+    session.setInputSize(level.inputSize);
+
+    double t = (double)cv::getTickCount();
+    session.detect(img, bBoxes, bVis);
+    t = 1000 * ((double)cv::getTickCount() - t) / cv::getTickFrequency();
+
+    // the first frame at a level includes the re-allocation of the network for the new model or input shape, so it
+    // is not part of the average; the remaining frames are smoothed so that a single slow one does not trigger a switch
+    const double alpha = 0.3;
+    if (framesAtLevel > 0)
+    {
+        avgLatency = framesAtLevel == 1 ? t : (1.0 - alpha) * avgLatency + alpha * t;
+    }
+    ++framesAtLevel;
+
+    // give each level a few measured frames to settle before judging it; only move back to a more accurate level when
+    // there is enough headroom, as the slower level will roughly double the inference time
+    const int minFramesAtLevel = 5;
+    const double upscaleHeadroom = 0.5;
+    if (framesAtLevel <= minFramesAtLevel)
+    {
+        return;
+    }
+    if (avgLatency > latencyBudget && currLevel + 1 < levels.size())
+    {
+        ++currLevel;
+        framesAtLevel = 0;
+    }
+    else if (avgLatency < upscaleHeadroom * latencyBudget && currLevel > 0)
+    {
+        --currLevel;
+        framesAtLevel = 0;
+    }
+}
+
+// convenience wrapper for a single image, which loads the network on every call; code which detects objects in a
+// sequence of images should own an ObjectDetector and reuse it across frames
+void detectObjects(cv::Mat& img, std::vector<BoundingBox>& bBoxes, float confThreshold, float nmsThreshold, 
+                   std::string basePath, std::string classesFile, std::string modelConfiguration, std::string modelWeights, bool bVis)
+{
+    ObjectDetector detector(classesFile, modelConfiguration, modelWeights, confThreshold, nmsThreshold);
+    detector.detect(img, bBoxes, bVis);
+}